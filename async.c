@@ -0,0 +1,341 @@
+#include "async.h"
+
+typedef struct AsyncWorkQueue {
+    AsyncChunkRequest* requests;
+    size_t numRequests;
+    size_t next;
+    ChunkCallback callback;
+    void* userData;
+} AsyncWorkQueue;
+
+int openAsyncRegion(const char* regionFolder, RegionID region, AsyncRegion* ar);
+void closeAsyncRegions(AsyncRegion* regions, size_t numRegions);
+int prepareChunkRequests(const char* regionFolder, ChunkID* chunks, size_t numChunks, ChunkCallback callback, void* userData, AsyncRegion** regions, size_t* numRegions, AsyncChunkRequest** requests, size_t* numRequests);
+void releaseChunkRequest(AsyncChunkRequest* request);
+void completeChunkRequest(AsyncChunkRequest* request, ssize_t nRead, ChunkCallback callback, void* userData);
+void* asyncWorker(void* arg);
+int loadChunksThreaded(AsyncChunkRequest* requests, size_t numRequests, ChunkCallback callback, void* userData);
+#ifdef HAVE_LIBURING
+int loadChunksUring(AsyncChunkRequest* requests, size_t numRequests, ChunkCallback callback, void* userData);
+#endif
+int loadChunksAsync(const char* regionFolder, ChunkID* chunks, size_t numChunks, ChunkCallback callback, void* userData);
+
+int openAsyncRegion(const char* regionFolder, RegionID region, AsyncRegion* ar) {
+    ar->region = region;
+    ar->fd = -1;
+    ar->pending = 0;
+    char* regionFilename = getRegionFilename(regionFolder,region);
+    if(regionFilename == NULL) {
+        return MEMORY_ERROR;
+    }
+    ar->fd = open(regionFilename,O_RDONLY);
+    free(regionFilename);
+    if(ar->fd == -1) {
+        return OPEN_ERROR;
+    }
+    return SUCCESS;
+}
+
+void closeAsyncRegions(AsyncRegion* regions, size_t numRegions) {
+    // Closing the descriptors drops any locks still held
+    for(size_t i = 0; i < numRegions; ++i) {
+        if(regions[i].fd != -1) {
+            close(regions[i].fd);
+        }
+    }
+    free(regions);
+}
+
+int prepareChunkRequests(const char* regionFolder, ChunkID* chunks, size_t numChunks, ChunkCallback callback, void* userData, AsyncRegion** regions, size_t* numRegions, AsyncChunkRequest** requests, size_t* numRequests) {
+    // Worst case every chunk lives in its own region
+    AsyncRegion* ar = calloc(numChunks,sizeof(AsyncRegion));
+    AsyncChunkRequest* req = calloc(numChunks,sizeof(AsyncChunkRequest));
+    if(ar == NULL || req == NULL) {
+        free(ar);
+        free(req);
+        return MEMORY_ERROR;
+    }
+    size_t nRegions = 0;
+    size_t nRequests = 0;
+
+    for(size_t i = 0; i < numChunks; ++i) {
+        RegionID region = translateChunkToRegion(chunks[i].x,chunks[i].z);
+        AsyncRegion* r = NULL;
+        for(size_t j = 0; j < nRegions; ++j) {
+            if(ar[j].region.x == region.x && ar[j].region.z == region.z) {
+                r = &ar[j];
+                break;
+            }
+        }
+        if(r == NULL) {
+            r = &ar[nRegions++];
+            int err = openAsyncRegion(regionFolder,region,r);
+            if(err != SUCCESS) {
+                // Keep the entry around so the rest of this region's chunks fail fast too
+                callback(chunks[i],err,NULL,userData);
+                continue;
+            }
+        }
+        if(r->fd == -1) {
+            callback(chunks[i],OPEN_ERROR,NULL,userData);
+            continue;
+        }
+
+        // Held until the region's reads are done, so no writer can move or rewrite the chunk under us.
+        // A chunk requested twice shares one lock, so locks are only dropped per region
+        off_t locationOffset = ((chunks[i].x & 31) + (chunks[i].z & 31) * CHUNK_OFFSET_LENGTH) * sizeof(uint32_t);
+        if(lockRegionRange(r->fd,F_RDLCK,locationOffset,sizeof(uint32_t)) != SUCCESS) {
+            callback(chunks[i],LOCK_ERROR,NULL,userData);
+            continue;
+        }
+        uint32_t location;
+        if(preadFully(r->fd,&location,sizeof(uint32_t),locationOffset) != sizeof(uint32_t)) {
+            callback(chunks[i],READ_ERROR,NULL,userData);
+            continue;
+        }
+        uint32_t sectorCount = location >> 24;
+        uint32_t sectorOffset = __bswap_32(location & 0x00FFFFFF) >> 8;
+        if(sectorOffset == 0 || sectorCount == 0) {
+            // Chunk not present. Hasn't been generated
+            callback(chunks[i],CHUNK_NOT_PRESENT,NULL,userData);
+            continue;
+        }
+
+        AsyncChunkRequest* request = &req[nRequests++];
+        request->chunk = chunks[i];
+        request->region = r;
+        request->fd = r->fd;
+        request->offset = (off_t)sectorOffset * CHUNK_SECTOR_SIZE;
+        request->length = (size_t)sectorCount * CHUNK_SECTOR_SIZE;
+        request->buffer = NULL;
+        ++r->pending;
+    }
+
+    // Nothing left to read in these, let writers in
+    for(size_t j = 0; j < nRegions; ++j) {
+        if(ar[j].fd != -1 && ar[j].pending == 0) {
+            lockRegionRange(ar[j].fd,F_UNLCK,0,CHUNK_SECTOR_SIZE);
+        }
+    }
+
+    *regions = ar;
+    *numRegions = nRegions;
+    *requests = req;
+    *numRequests = nRequests;
+    return SUCCESS;
+}
+
+void releaseChunkRequest(AsyncChunkRequest* request) {
+    // The last read of a region drops its location locks
+    if(__atomic_sub_fetch(&request->region->pending,1,__ATOMIC_ACQ_REL) == 0) {
+        lockRegionRange(request->fd,F_UNLCK,0,CHUNK_SECTOR_SIZE);
+    }
+}
+
+void completeChunkRequest(AsyncChunkRequest* request, ssize_t nRead, ChunkCallback callback, void* userData) {
+    releaseChunkRequest(request);
+    void* chunkData = NULL;
+    ssize_t chunkLength = READ_ERROR;
+    if(nRead > 0) {
+        chunkLength = inflateChunk(request->buffer,nRead,&chunkData);
+    }
+    free(request->buffer);
+    request->buffer = NULL;
+    if(chunkLength < 0) {
+        chunkData = NULL;
+    }
+    callback(request->chunk,chunkLength,chunkData,userData);
+}
+
+void* asyncWorker(void* arg) {
+    AsyncWorkQueue* queue = (AsyncWorkQueue*)arg;
+    size_t i;
+    while((i = __atomic_fetch_add(&queue->next,1,__ATOMIC_RELAXED)) < queue->numRequests) {
+        AsyncChunkRequest* request = &queue->requests[i];
+        request->buffer = malloc(request->length);
+        if(request->buffer == NULL) {
+            releaseChunkRequest(request);
+            queue->callback(request->chunk,MEMORY_ERROR,NULL,queue->userData);
+            continue;
+        }
+        ssize_t nRead = 0;
+        size_t totalRead = 0;
+        while(totalRead < request->length && (nRead = pread(request->fd,request->buffer + totalRead,request->length - totalRead,request->offset + totalRead))) {
+            if(nRead == -1) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            totalRead += nRead;
+        }
+        completeChunkRequest(request,(nRead == -1) ? READ_ERROR : (ssize_t)totalRead,queue->callback,queue->userData);
+    }
+    return NULL;
+}
+
+int loadChunksThreaded(AsyncChunkRequest* requests, size_t numRequests, ChunkCallback callback, void* userData) {
+    AsyncWorkQueue queue;
+    queue.requests = requests;
+    queue.numRequests = numRequests;
+    queue.next = 0;
+    queue.callback = callback;
+    queue.userData = userData;
+
+    pthread_t workers[ASYNC_WORKER_THREADS];
+    unsigned int numWorkers = 0;
+    for(; numWorkers < ASYNC_WORKER_THREADS && numWorkers < numRequests; ++numWorkers) {
+        if(pthread_create(&workers[numWorkers],NULL,asyncWorker,&queue) != 0) {
+            break;
+        }
+    }
+    if(numWorkers == 0) {
+        // Couldn't spawn anything, do the work ourselves
+        asyncWorker(&queue);
+    }
+    for(unsigned int i = 0; i < numWorkers; ++i) {
+        pthread_join(workers[i],NULL);
+    }
+    return SUCCESS;
+}
+
+#ifdef HAVE_LIBURING
+int loadChunksUring(AsyncChunkRequest* requests, size_t numRequests, ChunkCallback callback, void* userData) {
+    struct io_uring ring;
+    if(io_uring_queue_init(ASYNC_QUEUE_DEPTH,&ring,0) < 0) {
+        return THREAD_ERROR;
+    }
+
+    // Requests go prepared -> queued in the ring -> submitted to the kernel -> completed.
+    // unsubmitted is the oldest request whose SQE the kernel hasn't taken yet
+    size_t prepared = 0;
+    size_t unsubmitted = 0;
+    size_t completed = 0;
+    unsigned int queued = 0;
+    unsigned int inFlight = 0;
+    while(completed < numRequests) {
+        // Keep the queue full, then inflate whatever finished while the rest is still being read
+        while(inFlight + queued < ASYNC_QUEUE_DEPTH && prepared < numRequests) {
+            AsyncChunkRequest* request = &requests[prepared];
+            request->buffer = malloc(request->length);
+            if(request->buffer == NULL) {
+                releaseChunkRequest(request);
+                callback(request->chunk,MEMORY_ERROR,NULL,userData);
+                ++prepared;
+                ++completed;
+                continue;
+            }
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            if(sqe == NULL) {
+                free(request->buffer);
+                request->buffer = NULL;
+                break;
+            }
+            io_uring_prep_read(sqe,request->fd,request->buffer,request->length,request->offset);
+            io_uring_sqe_set_data(sqe,request);
+            ++prepared;
+            ++queued;
+        }
+        int ret;
+        if(queued) {
+            while((ret = io_uring_submit(&ring)) == -EINTR || ret == -EAGAIN);
+            if(ret < 0) {
+                break;
+            }
+            // Only what the kernel took is in flight, anything else stays queued for the next submit
+            inFlight += ret;
+            queued -= ret;
+            for(; ret > 0; ++unsubmitted) {
+                if(requests[unsubmitted].buffer != NULL) {
+                    --ret;
+                }
+            }
+        }
+        if(inFlight == 0) {
+            continue;
+        }
+
+        struct io_uring_cqe* cqe;
+        while((ret = io_uring_wait_cqe(&ring,&cqe)) == -EINTR);
+        if(ret < 0) {
+            break;
+        }
+        do {
+            AsyncChunkRequest* request = (AsyncChunkRequest*)io_uring_cqe_get_data(cqe);
+            ssize_t nRead = (cqe->res < 0) ? READ_ERROR : cqe->res;
+            io_uring_cqe_seen(&ring,cqe);
+            --inFlight;
+            ++completed;
+            completeChunkRequest(request,nRead,callback,userData);
+        } while(io_uring_peek_cqe(&ring,&cqe) == 0);
+    }
+
+    if(completed < numRequests) {
+        // The ring broke down. Drain what the kernel has, then fail the rest
+        while(inFlight) {
+            struct io_uring_cqe* cqe;
+            if(io_uring_wait_cqe(&ring,&cqe) < 0) {
+                break;
+            }
+            AsyncChunkRequest* request = (AsyncChunkRequest*)io_uring_cqe_get_data(cqe);
+            ssize_t nRead = (cqe->res < 0) ? READ_ERROR : cqe->res;
+            io_uring_cqe_seen(&ring,cqe);
+            --inFlight;
+            completeChunkRequest(request,nRead,callback,userData);
+        }
+        io_uring_queue_exit(&ring);
+        // Only if waiting failed: the kernel may still write to these buffers, so they are left alone
+        for(size_t i = 0; inFlight && i < unsubmitted; ++i) {
+            if(requests[i].buffer != NULL) {
+                callback(requests[i].chunk,READ_ERROR,NULL,userData);
+            }
+        }
+        // Queued but never submitted, the kernel doesn't know about these buffers
+        for(; unsubmitted < prepared; ++unsubmitted) {
+            if(requests[unsubmitted].buffer != NULL) {
+                free(requests[unsubmitted].buffer);
+                requests[unsubmitted].buffer = NULL;
+                releaseChunkRequest(&requests[unsubmitted]);
+                callback(requests[unsubmitted].chunk,READ_ERROR,NULL,userData);
+            }
+        }
+        for(; prepared < numRequests; ++prepared) {
+            releaseChunkRequest(&requests[prepared]);
+            callback(requests[prepared].chunk,READ_ERROR,NULL,userData);
+        }
+        return READ_ERROR;
+    }
+
+    io_uring_queue_exit(&ring);
+    return SUCCESS;
+}
+#endif
+
+int loadChunksAsync(const char* regionFolder, ChunkID* chunks, size_t numChunks, ChunkCallback callback, void* userData) {
+    if(numChunks == 0) {
+        return SUCCESS;
+    }
+
+    AsyncRegion* regions;
+    size_t numRegions;
+    AsyncChunkRequest* requests;
+    size_t numRequests;
+    int err = prepareChunkRequests(regionFolder,chunks,numChunks,callback,userData,&regions,&numRegions,&requests,&numRequests);
+    if(err != SUCCESS) {
+        return err;
+    }
+
+#ifdef HAVE_LIBURING
+    err = loadChunksUring(requests,numRequests,callback,userData);
+    if(err == THREAD_ERROR) {
+        // io_uring not available on this kernel (or blocked by seccomp)
+        err = loadChunksThreaded(requests,numRequests,callback,userData);
+    }
+#else
+    err = loadChunksThreaded(requests,numRequests,callback,userData);
+#endif
+
+    closeAsyncRegions(regions,numRegions);
+    free(requests);
+    return err;
+}
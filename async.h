@@ -0,0 +1,53 @@
+#ifndef _ASYNC_H
+#define _ASYNC_H
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <byteswap.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "chunk.h"
+#include "errors.h"
+
+#ifndef ASYNC_QUEUE_DEPTH
+#define ASYNC_QUEUE_DEPTH 32
+#endif
+
+#ifndef ASYNC_WORKER_THREADS
+#define ASYNC_WORKER_THREADS 4
+#endif
+
+// Called once per requested chunk. On success chunkLength is the decompressed
+// length and chunkData belongs to the callback, same as with loadChunk. On
+// failure chunkLength is one of the error codes and chunkData is NULL.
+// With the thread pool backend the callback runs on worker threads, so it
+// must be safe to call concurrently. Read locks on the requested location
+// entries are held until every chunk of their region has been read, so the
+// callback must not write to the regions being loaded.
+typedef void (*ChunkCallback)(ChunkID chunk, ssize_t chunkLength, void* chunkData, void* userData);
+
+typedef struct AsyncRegion {
+    RegionID region;
+    int fd;
+    size_t pending;
+} AsyncRegion;
+
+typedef struct AsyncChunkRequest {
+    ChunkID chunk;
+    AsyncRegion* region;
+    int fd;
+    off_t offset;
+    size_t length;
+    void* buffer;
+} AsyncChunkRequest;
+
+int loadChunksAsync(const char* regionFolder, ChunkID* chunks, size_t numChunks, ChunkCallback callback, void* userData);
+
+#endif
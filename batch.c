@@ -0,0 +1,258 @@
+#include "batch.h"
+
+typedef struct BatchWorkQueue {
+    ChunkUpdate* updates;
+    unsigned int numUpdates;
+    unsigned int next;
+} BatchWorkQueue;
+
+int initRegionBatch(RegionBatch* batch, const char* regionFolder, RegionID region);
+int addChunkToBatch(RegionBatch* batch, ChunkID chunk, void* chunkData, size_t chunkLength);
+void* compressWorker(void* arg);
+void compressBatch(RegionBatch* batch);
+ssize_t allocateSectors(uint8_t** used, size_t* numSectors, unsigned int count);
+int commitRegionBatch(RegionBatch* batch);
+void destroyRegionBatch(RegionBatch* batch);
+
+int initRegionBatch(RegionBatch* batch, const char* regionFolder, RegionID region) {
+    batch->regionFolder = strdup(regionFolder);
+    if(batch->regionFolder == NULL) {
+        return MEMORY_ERROR;
+    }
+    batch->region = region;
+    batch->numUpdates = 0;
+    batch->capacity = 0;
+    batch->updates = NULL;
+    return SUCCESS;
+}
+
+int addChunkToBatch(RegionBatch* batch, ChunkID chunk, void* chunkData, size_t chunkLength) {
+    RegionID region = translateChunkToRegion(chunk.x,chunk.z);
+    if(region.x != batch->region.x || region.z != batch->region.z) {
+        return CHUNK_NOT_IN_REGION;
+    }
+
+    // Last write wins if the same chunk is updated twice in a batch
+    for(unsigned int i = 0; i < batch->numUpdates; ++i) {
+        if(batch->updates[i].chunk.x == chunk.x && batch->updates[i].chunk.z == chunk.z) {
+            batch->updates[i].chunkData = chunkData;
+            batch->updates[i].chunkLength = chunkLength;
+            return SUCCESS;
+        }
+    }
+
+    if(batch->numUpdates == batch->capacity) {
+        void* newptr = reallocarray(batch->updates,batch->capacity + BATCH_REALLOC_SIZE,sizeof(ChunkUpdate));
+        if(newptr == NULL) {
+            return MEMORY_ERROR;
+        }
+        batch->updates = newptr;
+        batch->capacity += BATCH_REALLOC_SIZE;
+    }
+    ChunkUpdate* update = &batch->updates[batch->numUpdates++];
+    update->chunk = chunk;
+    update->chunkData = chunkData;
+    update->chunkLength = chunkLength;
+    update->compressed = NULL;
+    update->compressedLength = 0;
+    return SUCCESS;
+}
+
+void* compressWorker(void* arg) {
+    BatchWorkQueue* queue = (BatchWorkQueue*)arg;
+    unsigned int i;
+    while((i = __atomic_fetch_add(&queue->next,1,__ATOMIC_RELAXED)) < queue->numUpdates) {
+        ChunkUpdate* update = &queue->updates[i];
+        update->compressedLength = deflateGzip(update->chunkData,update->chunkLength,&update->compressed,1);
+        if(update->compressedLength < 0) {
+            update->compressed = NULL;
+        }
+    }
+    return NULL;
+}
+
+void compressBatch(RegionBatch* batch) {
+    BatchWorkQueue queue;
+    queue.updates = batch->updates;
+    queue.numUpdates = batch->numUpdates;
+    queue.next = 0;
+
+    pthread_t workers[BATCH_WORKER_THREADS];
+    unsigned int numWorkers = 0;
+    for(; numWorkers < BATCH_WORKER_THREADS && numWorkers < batch->numUpdates; ++numWorkers) {
+        if(pthread_create(&workers[numWorkers],NULL,compressWorker,&queue) != 0) {
+            break;
+        }
+    }
+    // Whatever is left (everything, if no thread could be spawned) gets done here
+    compressWorker(&queue);
+    for(unsigned int i = 0; i < numWorkers; ++i) {
+        pthread_join(workers[i],NULL);
+    }
+}
+
+ssize_t allocateSectors(uint8_t** used, size_t* numSectors, unsigned int count) {
+    // First fit among the sectors nothing points to, otherwise grow the file
+    size_t run = 0;
+    for(size_t i = 0; i < *numSectors; ++i) {
+        run = (*used)[i] ? 0 : run + 1;
+        if(run == count) {
+            memset(*used + i + 1 - count,1,count);
+            return i + 1 - count;
+        }
+    }
+    size_t start = *numSectors - run;
+    void* newptr = realloc(*used,start + count);
+    if(newptr == NULL) {
+        return MEMORY_ERROR;
+    }
+    *used = newptr;
+    memset(*used + start,1,count);
+    *numSectors = start + count;
+    return start;
+}
+
+int commitRegionBatch(RegionBatch* batch) {
+    if(batch->numUpdates == 0) {
+        return SUCCESS;
+    }
+
+    char* regionFilename = getRegionFilename(batch->regionFolder,batch->region);
+    if(regionFilename == NULL) {
+        return MEMORY_ERROR;
+    }
+    int fd = open(regionFilename,O_RDWR | O_CREAT,0644);
+    free(regionFilename);
+    if(fd == -1) {
+        return OPEN_ERROR;
+    }
+
+    // Holding the timestamp table keeps other batches (and overwriteChunk) out until we're done,
+    // while readers, which only lock location entries, carry on with the old chunks
+    if(lockRegionRange(fd,F_WRLCK,CHUNK_TIMESTAMP_TABLE_OFFSET,CHUNK_SECTOR_SIZE) != SUCCESS) {
+        close(fd);
+        return LOCK_ERROR;
+    }
+
+    struct stat sb;
+    if(fstat(fd,&sb) == -1) {
+        close(fd);
+        return ACCESS_ERROR;
+    }
+
+    uint32_t* header = calloc(REGION_HEADER_SIZE,sizeof(uint8_t));
+    if(header == NULL) {
+        close(fd);
+        return MEMORY_ERROR;
+    }
+    if(sb.st_size >= REGION_HEADER_SIZE && pread(fd,header,REGION_HEADER_SIZE,0) != REGION_HEADER_SIZE) {
+        free(header);
+        close(fd);
+        return READ_ERROR;
+    }
+    uint32_t* locations = header;
+    uint32_t* timestamps = header + CHUNK_OFFSET_LENGTH * CHUNK_OFFSET_LENGTH;
+
+    // Mark every sector the current tables point to, those can't be touched until the new tables are on disk
+    size_t numSectors = (sb.st_size + CHUNK_SECTOR_SIZE - 1) / CHUNK_SECTOR_SIZE;
+    if(numSectors < REGION_HEADER_SIZE / CHUNK_SECTOR_SIZE) {
+        numSectors = REGION_HEADER_SIZE / CHUNK_SECTOR_SIZE;
+    }
+    uint8_t* used = calloc(numSectors,sizeof(uint8_t));
+    if(used == NULL) {
+        free(header);
+        close(fd);
+        return MEMORY_ERROR;
+    }
+    memset(used,1,REGION_HEADER_SIZE / CHUNK_SECTOR_SIZE);
+    for(unsigned int i = 0; i < CHUNK_OFFSET_LENGTH * CHUNK_OFFSET_LENGTH; ++i) {
+        size_t sectorCount = locations[i] >> 24;
+        size_t sectorOffset = __bswap_32(locations[i] & 0x00FFFFFF) >> 8;
+        for(size_t s = sectorOffset; sectorOffset && s < sectorOffset + sectorCount && s < numSectors; ++s) {
+            used[s] = 1;
+        }
+    }
+
+    compressBatch(batch);
+
+    int err = SUCCESS;
+    uint32_t now = __bswap_32((uint32_t)time(NULL));
+    for(unsigned int i = 0; i < batch->numUpdates && err == SUCCESS; ++i) {
+        ChunkUpdate* update = &batch->updates[i];
+        if(update->compressedLength < 0) {
+            err = update->compressedLength;
+            break;
+        }
+        size_t rawLength = sizeof(ChunkHeader) + update->compressedLength;
+        unsigned int sectorCount = (rawLength + CHUNK_SECTOR_SIZE - 1) / CHUNK_SECTOR_SIZE;
+        if(sectorCount > MAX_CHUNK_SECTORS) {
+            err = INSUFFICIENT_SPACE_FOR_CHUNK;
+            break;
+        }
+        ssize_t sectorOffset = allocateSectors(&used,&numSectors,sectorCount);
+        if(sectorOffset < 0) {
+            err = sectorOffset;
+            break;
+        }
+
+        uint8_t* sectors = calloc(sectorCount,CHUNK_SECTOR_SIZE);
+        if(sectors == NULL) {
+            err = MEMORY_ERROR;
+            break;
+        }
+        ChunkHeader chunkHeader;
+        chunkHeader.length = __bswap_32((uint32_t)update->compressedLength + 1);
+        chunkHeader.compressionType = COMPRESSION_TYPE_ZLIB;
+        memcpy(sectors,&chunkHeader,sizeof(ChunkHeader));
+        memcpy(sectors + sizeof(ChunkHeader),update->compressed,update->compressedLength);
+        if(pwriteFully(fd,sectors,(size_t)sectorCount * CHUNK_SECTOR_SIZE,(off_t)sectorOffset * CHUNK_SECTOR_SIZE) < 0) {
+            err = WRITE_ERROR;
+        }
+        free(sectors);
+
+        unsigned int index = (update->chunk.x & 31) + (update->chunk.z & 31) * CHUNK_OFFSET_LENGTH;
+        locations[index] = __bswap_32(((uint32_t)sectorOffset << 8) | sectorCount);
+        timestamps[index] = now;
+    }
+
+    // The new chunk data has to be durable before anything points to it
+    if(err == SUCCESS && fdatasync(fd) == -1) {
+        err = WRITE_ERROR;
+    }
+    // Readers in the middle of loading a chunk finish with the old location before the table changes
+    if(err == SUCCESS && lockRegionRange(fd,F_WRLCK,0,CHUNK_SECTOR_SIZE) != SUCCESS) {
+        err = LOCK_ERROR;
+    }
+    if(err == SUCCESS && pwriteFully(fd,header,REGION_HEADER_SIZE,0) < 0) {
+        err = WRITE_ERROR;
+    }
+    lockRegionRange(fd,F_UNLCK,0,CHUNK_SECTOR_SIZE);
+    if(err == SUCCESS && fsync(fd) == -1) {
+        err = WRITE_ERROR;
+    }
+
+    for(unsigned int i = 0; i < batch->numUpdates; ++i) {
+        free(batch->updates[i].compressed);
+        batch->updates[i].compressed = NULL;
+        batch->updates[i].compressedLength = 0;
+    }
+    if(err == SUCCESS) {
+        batch->numUpdates = 0;
+    }
+    free(used);
+    free(header);
+    close(fd);
+    return err;
+}
+
+void destroyRegionBatch(RegionBatch* batch) {
+    for(unsigned int i = 0; i < batch->numUpdates; ++i) {
+        free(batch->updates[i].compressed);
+    }
+    free(batch->updates);
+    free(batch->regionFolder);
+    batch->updates = NULL;
+    batch->regionFolder = NULL;
+    batch->numUpdates = 0;
+    batch->capacity = 0;
+}
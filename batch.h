@@ -0,0 +1,54 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <byteswap.h>
+#include <sys/stat.h>
+
+#include "chunk.h"
+#include "compression.h"
+#include "errors.h"
+
+#ifndef BATCH_WORKER_THREADS
+#define BATCH_WORKER_THREADS 4
+#endif
+
+#ifndef BATCH_REALLOC_SIZE
+#define BATCH_REALLOC_SIZE 32
+#endif
+
+#define MAX_CHUNK_SECTORS 255
+
+typedef struct ChunkUpdate {
+    ChunkID chunk;
+    void* chunkData;
+    size_t chunkLength;
+    void* compressed;
+    ssize_t compressedLength;
+} ChunkUpdate;
+
+// Collects chunk updates for a single region and writes them all at once.
+// Chunk data is not copied, it must stay valid until commitRegionBatch returns.
+// Compressed chunks go to sectors no chunk in the current location table is
+// using, and the tables are only rewritten once that data is on disk, so a
+// crash before the commit finishes leaves every old chunk readable.
+typedef struct RegionBatch {
+    char* regionFolder;
+    RegionID region;
+    unsigned int numUpdates;
+    unsigned int capacity;
+    ChunkUpdate* updates;
+} RegionBatch;
+
+int initRegionBatch(RegionBatch* batch, const char* regionFolder, RegionID region);
+int addChunkToBatch(RegionBatch* batch, ChunkID chunk, void* chunkData, size_t chunkLength);
+int commitRegionBatch(RegionBatch* batch);
+void destroyRegionBatch(RegionBatch* batch);
+
+#endif
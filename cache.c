@@ -0,0 +1,304 @@
+#include "cache.h"
+
+int initChunkCache(ChunkCache* cache, size_t memoryBudget);
+void destroyChunkCache(ChunkCache* cache);
+unsigned int hashChunkKey(const char* regionFolder, ChunkID chunk);
+ChunkCacheEntry* findCacheEntry(ChunkCache* cache, const char* regionFolder, ChunkID chunk);
+void unlinkCacheEntry(ChunkCache* cache, ChunkCacheEntry* entry);
+void removeCacheEntry(ChunkCache* cache, ChunkCacheEntry* entry);
+void pushCacheEntry(ChunkCache* cache, ChunkCacheEntry* entry);
+void touchCacheEntry(ChunkCache* cache, ChunkCacheEntry* entry);
+void evictCacheEntries(ChunkCache* cache);
+int statRegion(const char* regionFolder, ChunkID chunk, struct timespec* mtime);
+int readChunkStamps(const char* regionFolder, ChunkID chunk, uint32_t* location, uint32_t* timestamp);
+ssize_t copyCacheEntry(ChunkCacheEntry* entry, void** chunkData);
+void insertCacheEntry(ChunkCache* cache, const char* regionFolder, ChunkID chunk, uint32_t location, uint32_t timestamp, time_t loadTime, struct timespec mtime, void* data, size_t length);
+ssize_t loadChunkCached(ChunkCache* cache, const char* regionFolder, ChunkID chunk, void** chunkData);
+int overwriteChunkCached(ChunkCache* cache, const char* regionFolder, ChunkID chunk, void* chunkData, size_t chunkLength);
+void invalidateChunk(ChunkCache* cache, const char* regionFolder, ChunkID chunk);
+void invalidateRegion(ChunkCache* cache, const char* regionFolder, RegionID region);
+
+int initChunkCache(ChunkCache* cache, size_t memoryBudget) {
+    memset(cache,0,sizeof(ChunkCache));
+    cache->memoryBudget = memoryBudget;
+    if(pthread_mutex_init(&cache->lock,NULL) != 0) {
+        return MEMORY_ERROR;
+    }
+    return SUCCESS;
+}
+
+void destroyChunkCache(ChunkCache* cache) {
+    while(cache->head != NULL) {
+        removeCacheEntry(cache,cache->head);
+    }
+    pthread_mutex_destroy(&cache->lock);
+}
+
+unsigned int hashChunkKey(const char* regionFolder, ChunkID chunk) {
+    // FNV-1a over the folder name, then the chunk coordinates
+    uint32_t hash = 2166136261u;
+    for(const char* c = regionFolder; *c; ++c) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    hash = (hash ^ (uint32_t)chunk.x) * 16777619u;
+    hash = (hash ^ (uint32_t)chunk.z) * 16777619u;
+    return hash % CHUNK_CACHE_BUCKETS;
+}
+
+ChunkCacheEntry* findCacheEntry(ChunkCache* cache, const char* regionFolder, ChunkID chunk) {
+    ChunkCacheEntry* entry = cache->buckets[hashChunkKey(regionFolder,chunk)];
+    while(entry != NULL) {
+        if(entry->chunk.x == chunk.x && entry->chunk.z == chunk.z && !strcmp(entry->regionFolder,regionFolder)) {
+            return entry;
+        }
+        entry = entry->hashNext;
+    }
+    return NULL;
+}
+
+void unlinkCacheEntry(ChunkCache* cache, ChunkCacheEntry* entry) {
+    if(entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if(entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+void removeCacheEntry(ChunkCache* cache, ChunkCacheEntry* entry) {
+    ChunkCacheEntry** slot = &cache->buckets[hashChunkKey(entry->regionFolder,entry->chunk)];
+    while(*slot != entry) {
+        slot = &(*slot)->hashNext;
+    }
+    *slot = entry->hashNext;
+    unlinkCacheEntry(cache,entry);
+    cache->memoryUsed -= entry->footprint;
+    free(entry->regionFolder);
+    free(entry->data);
+    free(entry);
+}
+
+void pushCacheEntry(ChunkCache* cache, ChunkCacheEntry* entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if(cache->head != NULL) {
+        cache->head->prev = entry;
+    }
+    cache->head = entry;
+    if(cache->tail == NULL) {
+        cache->tail = entry;
+    }
+}
+
+void touchCacheEntry(ChunkCache* cache, ChunkCacheEntry* entry) {
+    if(cache->head == entry) {
+        return;
+    }
+    unlinkCacheEntry(cache,entry);
+    pushCacheEntry(cache,entry);
+}
+
+void evictCacheEntries(ChunkCache* cache) {
+    while(cache->memoryUsed > cache->memoryBudget && cache->tail != NULL) {
+        removeCacheEntry(cache,cache->tail);
+    }
+}
+
+int statRegion(const char* regionFolder, ChunkID chunk, struct timespec* mtime) {
+    char* regionFilename = getRegionFilename(regionFolder,translateChunkToRegion(chunk.x,chunk.z));
+    if(regionFilename == NULL) {
+        return MEMORY_ERROR;
+    }
+    struct stat sb;
+    int err = stat(regionFilename,&sb);
+    free(regionFilename);
+    if(err == -1) {
+        return ACCESS_ERROR;
+    }
+    *mtime = sb.st_mtim;
+    return SUCCESS;
+}
+
+int readChunkStamps(const char* regionFolder, ChunkID chunk, uint32_t* location, uint32_t* timestamp) {
+    char* regionFilename = getRegionFilename(regionFolder,translateChunkToRegion(chunk.x,chunk.z));
+    if(regionFilename == NULL) {
+        return MEMORY_ERROR;
+    }
+    int fd = open(regionFilename,O_RDONLY);
+    free(regionFilename);
+    if(fd == -1) {
+        return OPEN_ERROR;
+    }
+
+    // Locked like loadChunk does, so both entries come from the same write
+    off_t locationOffset = ((chunk.x & 31) + (chunk.z & 31) * CHUNK_OFFSET_LENGTH) * sizeof(uint32_t);
+    if(lockRegionRange(fd,F_RDLCK,locationOffset,sizeof(uint32_t)) != SUCCESS) {
+        close(fd);
+        return LOCK_ERROR;
+    }
+    uint32_t chunkLocation;
+    uint32_t chunkTimestamp;
+    if(preadFully(fd,&chunkLocation,sizeof(uint32_t),locationOffset) != sizeof(uint32_t)
+       || preadFully(fd,&chunkTimestamp,sizeof(uint32_t),CHUNK_TIMESTAMP_TABLE_OFFSET + locationOffset) != sizeof(uint32_t)) {
+        close(fd);
+        return READ_ERROR;
+    }
+    // Closing the descriptor drops the lock
+    close(fd);
+
+    *location = chunkLocation;
+    *timestamp = __bswap_32(chunkTimestamp);
+    return SUCCESS;
+}
+
+ssize_t copyCacheEntry(ChunkCacheEntry* entry, void** chunkData) {
+    void* data = malloc(entry->length);
+    if(data == NULL) {
+        return MEMORY_ERROR;
+    }
+    memcpy(data,entry->data,entry->length);
+    *chunkData = data;
+    return entry->length;
+}
+
+void insertCacheEntry(ChunkCache* cache, const char* regionFolder, ChunkID chunk, uint32_t location, uint32_t timestamp, time_t loadTime, struct timespec mtime, void* data, size_t length) {
+    size_t footprint = sizeof(ChunkCacheEntry) + strlen(regionFolder) + 1 + length;
+    if(footprint > cache->memoryBudget) {
+        return;
+    }
+
+    ChunkCacheEntry* entry = calloc(1,sizeof(ChunkCacheEntry));
+    if(entry == NULL) {
+        return;
+    }
+    entry->regionFolder = strdup(regionFolder);
+    entry->data = malloc(length);
+    if(entry->regionFolder == NULL || entry->data == NULL) {
+        free(entry->regionFolder);
+        free(entry->data);
+        free(entry);
+        return;
+    }
+    memcpy(entry->data,data,length);
+    entry->chunk = chunk;
+    entry->location = location;
+    entry->timestamp = timestamp;
+    entry->loadTime = loadTime;
+    entry->regionMtime = mtime;
+    entry->length = length;
+    entry->footprint = footprint;
+
+    pthread_mutex_lock(&cache->lock);
+    // Another thread may have loaded the same chunk while we were reading it
+    ChunkCacheEntry* existing = findCacheEntry(cache,regionFolder,chunk);
+    if(existing != NULL) {
+        removeCacheEntry(cache,existing);
+    }
+    unsigned int bucket = hashChunkKey(regionFolder,chunk);
+    entry->hashNext = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    pushCacheEntry(cache,entry);
+    cache->memoryUsed += footprint;
+    evictCacheEntries(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+ssize_t loadChunkCached(ChunkCache* cache, const char* regionFolder, ChunkID chunk, void** chunkData) {
+    struct timespec mtime;
+    int err = statRegion(regionFolder,chunk,&mtime);
+    if(err != SUCCESS) {
+        return err;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    ChunkCacheEntry* entry = findCacheEntry(cache,regionFolder,chunk);
+    if(entry != NULL) {
+        if(entry->regionMtime.tv_sec != mtime.tv_sec || entry->regionMtime.tv_nsec != mtime.tv_nsec) {
+            // The region was written to, but maybe not this chunk. Check where it lives and when it was
+            // last written before throwing it away. A write in the second the entry was loaded, or later,
+            // can leave the timestamp unchanged, so that counts as stale too
+            uint32_t cachedLocation = entry->location;
+            uint32_t cachedTimestamp = entry->timestamp;
+            time_t loadTime = entry->loadTime;
+            pthread_mutex_unlock(&cache->lock);
+            uint32_t location;
+            uint32_t timestamp;
+            err = readChunkStamps(regionFolder,chunk,&location,&timestamp);
+            pthread_mutex_lock(&cache->lock);
+            entry = findCacheEntry(cache,regionFolder,chunk);
+            if(entry != NULL) {
+                if(err == SUCCESS && location == cachedLocation && timestamp == cachedTimestamp && (time_t)timestamp < loadTime
+                   && entry->location == cachedLocation && entry->timestamp == cachedTimestamp) {
+                    entry->regionMtime = mtime;
+                } else {
+                    removeCacheEntry(cache,entry);
+                    entry = NULL;
+                }
+            }
+        }
+    }
+    if(entry != NULL) {
+        touchCacheEntry(cache,entry);
+        ++cache->hits;
+        ssize_t chunkLength = copyCacheEntry(entry,chunkData);
+        pthread_mutex_unlock(&cache->lock);
+        return chunkLength;
+    }
+    ++cache->misses;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Read the location and timestamp before the data, so that a concurrent write makes the entry look stale rather than fresh
+    time_t loadTime = time(NULL);
+    uint32_t location = 0;
+    uint32_t timestamp = 0;
+    err = readChunkStamps(regionFolder,chunk,&location,&timestamp);
+    if(err != SUCCESS) {
+        return err;
+    }
+    void* decompressedChunk;
+    ssize_t chunkLength = loadChunk(regionFolder,chunk,&decompressedChunk);
+    if(chunkLength < 0) {
+        return chunkLength;
+    }
+    insertCacheEntry(cache,regionFolder,chunk,location,timestamp,loadTime,mtime,decompressedChunk,chunkLength);
+
+    *chunkData = decompressedChunk;
+    return chunkLength;
+}
+
+int overwriteChunkCached(ChunkCache* cache, const char* regionFolder, ChunkID chunk, void* chunkData, size_t chunkLength) {
+    invalidateChunk(cache,regionFolder,chunk);
+    int err = overwriteChunk(regionFolder,chunk,chunkData,chunkLength);
+    // Drop anything a concurrent reader may have cached while the write was in progress
+    invalidateChunk(cache,regionFolder,chunk);
+    return err;
+}
+
+void invalidateChunk(ChunkCache* cache, const char* regionFolder, ChunkID chunk) {
+    pthread_mutex_lock(&cache->lock);
+    ChunkCacheEntry* entry = findCacheEntry(cache,regionFolder,chunk);
+    if(entry != NULL) {
+        removeCacheEntry(cache,entry);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void invalidateRegion(ChunkCache* cache, const char* regionFolder, RegionID region) {
+    pthread_mutex_lock(&cache->lock);
+    ChunkCacheEntry* entry = cache->head;
+    while(entry != NULL) {
+        ChunkCacheEntry* next = entry->next;
+        RegionID entryRegion = translateChunkToRegion(entry->chunk.x,entry->chunk.z);
+        if(entryRegion.x == region.x && entryRegion.z == region.z && !strcmp(entry->regionFolder,regionFolder)) {
+            removeCacheEntry(cache,entry);
+        }
+        entry = next;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,56 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "chunk.h"
+#include "errors.h"
+
+#ifndef CHUNK_CACHE_BUCKETS
+#define CHUNK_CACHE_BUCKETS 1024
+#endif
+
+typedef struct ChunkCacheEntry {
+    char* regionFolder;
+    ChunkID chunk;
+    uint32_t location;
+    uint32_t timestamp;
+    time_t loadTime;
+    struct timespec regionMtime;
+    void* data;
+    size_t length;
+    size_t footprint;
+    struct ChunkCacheEntry* prev;
+    struct ChunkCacheEntry* next;
+    struct ChunkCacheEntry* hashNext;
+} ChunkCacheEntry;
+
+// Decompressed chunks keyed by (region folder, ChunkID), evicted in LRU order
+// once memoryUsed goes over memoryBudget. All operations take the cache lock,
+// so one cache can be shared between threads. Entries are revalidated against
+// the region file mtime and, when that changed, against the chunk's location
+// and timestamp entries. Timestamps only have one second resolution, so one
+// at or after the second the entry was loaded counts as stale.
+typedef struct ChunkCache {
+    size_t memoryBudget;
+    size_t memoryUsed;
+    ChunkCacheEntry* buckets[CHUNK_CACHE_BUCKETS];
+    ChunkCacheEntry* head;
+    ChunkCacheEntry* tail;
+    pthread_mutex_t lock;
+    uint64_t hits;
+    uint64_t misses;
+} ChunkCache;
+
+int initChunkCache(ChunkCache* cache, size_t memoryBudget);
+void destroyChunkCache(ChunkCache* cache);
+ssize_t loadChunkCached(ChunkCache* cache, const char* regionFolder, ChunkID chunk, void** chunkData);
+int overwriteChunkCached(ChunkCache* cache, const char* regionFolder, ChunkID chunk, void* chunkData, size_t chunkLength);
+void invalidateChunk(ChunkCache* cache, const char* regionFolder, ChunkID chunk);
+void invalidateRegion(ChunkCache* cache, const char* regionFolder, RegionID region);
+
+#endif
@@ -3,6 +3,11 @@
 RegionID translateChunkToRegion(int x, int z);
 RegionID translateCoordsToRegion(double x, double y, double z);
 ChunkID translateCoordsToChunk(double x, double y, double z);
+char* getRegionFilename(const char* regionFolder, RegionID region);
+ssize_t inflateChunk(void* rawChunk, size_t rawLength, void** chunkData);
+int lockRegionRange(int fd, short type, off_t start, off_t length);
+ssize_t preadFully(int fd, void* data, size_t length, off_t offset);
+ssize_t pwriteFully(int fd, void* data, size_t length, off_t offset);
 int overwriteChunk(const char* regionFolder, ChunkID chunk, void* chunkData, size_t chunkLength);
 ssize_t loadChunk(const char* regionFolder, ChunkID chunk, void** chunkData);
 
@@ -25,40 +30,145 @@ ChunkID translateCoordsToChunk(double x, double y, double z) {
     return chunk;
 }
 
+char* getRegionFilename(const char* regionFolder, RegionID region) {
+    char* regionFilename = calloc(MAX_REGION_FILENAME_LENGTH + strlen(regionFolder),sizeof(char));
+    if(regionFilename == NULL) {
+        return NULL;
+    }
+    sprintf(regionFilename,"%s/r.%d.%d.mca",regionFolder,region.x,region.z);
+    return regionFilename;
+}
+
+int readRegionHeader(const char* regionFolder, RegionID region, uint32_t* header) {
+    // header gets both the location and timestamp tables, CHUNKS_PER_REGION * CHUNKS_PER_REGION entries each
+    char* regionFilename = getRegionFilename(regionFolder,region);
+    if(regionFilename == NULL) {
+        return MEMORY_ERROR;
+    }
+
+    int fd = open(regionFilename,O_RDONLY);
+    free(regionFilename);
+    if(fd == -1) {
+        return OPEN_ERROR;
+    }
+
+    if(pread(fd,header,REGION_HEADER_SIZE,0) != REGION_HEADER_SIZE) {
+        close(fd);
+        return READ_ERROR;
+    }
+    close(fd);
+    return SUCCESS;
+}
+
+ssize_t inflateChunk(void* rawChunk, size_t rawLength, void** chunkData) {
+    // rawChunk holds the chunk's sectors as stored in the region: header followed by the compressed data
+    if(rawLength < sizeof(ChunkHeader)) {
+        return READ_ERROR;
+    }
+    ChunkHeader header;
+    memcpy(&header,rawChunk,sizeof(ChunkHeader));
+    header.length = __bswap_32(header.length);
+    if((header.compressionType != COMPRESSION_TYPE_ZLIB && header.compressionType != COMPRESSION_TYPE_GZIP) || header.length == 0) {
+        return INVALID_HEADER;
+    }
+    if(header.length - 1 > rawLength - sizeof(ChunkHeader)) {
+        return READ_ERROR;
+    }
+    // length counts the compression type byte as well
+    return inflateGzip((uint8_t*)rawChunk + sizeof(ChunkHeader),header.length - 1,chunkData,(header.compressionType == COMPRESSION_TYPE_ZLIB));
+}
+
+int lockRegionRange(int fd, short type, off_t start, off_t length) {
+    struct flock lock;
+    memset(&lock,0,sizeof(struct flock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = length;
+    while(fcntl(fd,REGION_LOCK_WAIT,&lock) == -1) {
+        if(errno != EINTR) {
+            return LOCK_ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+ssize_t preadFully(int fd, void* data, size_t length, off_t offset) {
+    ssize_t nRead = 0;
+    size_t totalRead = 0;
+    while(totalRead < length && (nRead = pread(fd,(uint8_t*)data + totalRead,length - totalRead,offset + totalRead))) {
+        if(nRead == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return READ_ERROR;
+        }
+        totalRead += nRead;
+    }
+    return totalRead;
+}
+
+ssize_t pwriteFully(int fd, void* data, size_t length, off_t offset) {
+    ssize_t nWritten = 0;
+    size_t totalWritten = 0;
+    while(totalWritten < length) {
+        nWritten = pwrite(fd,(uint8_t*)data + totalWritten,length - totalWritten,offset + totalWritten);
+        if(nWritten == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return WRITE_ERROR;
+        }
+        totalWritten += nWritten;
+    }
+    return totalWritten;
+}
+
 int overwriteChunk(const char* regionFolder, ChunkID chunk, void* chunkData, size_t chunkLength) {
     RegionID region = translateChunkToRegion(chunk.x,chunk.z);
     ChunkID relativeChunk;
     relativeChunk.x = chunk.x & 31;
     relativeChunk.z = chunk.z & 31;
 
-    char* regionFilename = calloc(MAX_REGION_FILENAME_LENGTH + strlen(regionFolder),sizeof(char));
-    sprintf(regionFilename,"%s/r.%d.%d.mca",regionFolder,region.x,region.z);
+    char* regionFilename = getRegionFilename(regionFolder,region);
+    if(regionFilename == NULL) {
+        return MEMORY_ERROR;
+    }
 
     if(access(regionFilename,R_OK | W_OK) == -1) {
+        free(regionFilename);
         return ACCESS_ERROR;
     }
 
     int fd = open(regionFilename,O_RDWR);
+    free(regionFilename);
     if(fd == -1) {
         return OPEN_ERROR;
     }
-    free(regionFilename);
+
+    // Timestamp entry first, then location entry. Batch commits take them in the same order
+    off_t locationOffset = (relativeChunk.x + relativeChunk.z * CHUNK_OFFSET_LENGTH) * sizeof(uint32_t);
+    off_t timestampOffset = CHUNK_TIMESTAMP_TABLE_OFFSET + locationOffset;
+    if(lockRegionRange(fd,F_WRLCK,timestampOffset,sizeof(uint32_t)) != SUCCESS || lockRegionRange(fd,F_WRLCK,locationOffset,sizeof(uint32_t)) != SUCCESS) {
+        close(fd);
+        return LOCK_ERROR;
+    }
 
     uint32_t chunkHeaderOffset;
-    if(pread(fd,&chunkHeaderOffset,sizeof(uint32_t),(relativeChunk.x + relativeChunk.z * CHUNK_OFFSET_LENGTH) * sizeof(uint32_t)) == -1) {
+    if(pread(fd,&chunkHeaderOffset,sizeof(uint32_t),locationOffset) != sizeof(uint32_t)) {
         close(fd);
         return READ_ERROR;
     }
-    uint32_t totalChunkLength = (chunkHeaderOffset >> 24) * 4096;
+    uint32_t totalChunkLength = (chunkHeaderOffset >> 24) * CHUNK_SECTOR_SIZE;
     chunkHeaderOffset = (__bswap_32(chunkHeaderOffset & 0x00FFFFFF) >> 8) * CHUNK_SECTOR_SIZE;
-    int pos = lseek(fd,chunkHeaderOffset,SEEK_SET);
-    if(pos == -1) {
+    if(chunkHeaderOffset == 0) {
+        // Chunk not present. There are no sectors to overwrite
         close(fd);
-        return SEEK_ERROR;
+        return CHUNK_NOT_PRESENT;
     }
 
     ChunkHeader header;
-    if(pread(fd,&header,sizeof(ChunkHeader),pos) <= 0) {
+    if(pread(fd,&header,sizeof(ChunkHeader),chunkHeaderOffset) != sizeof(ChunkHeader)) {
         close(fd);
         return READ_ERROR;
     }
@@ -71,7 +181,7 @@ int overwriteChunk(const char* regionFolder, ChunkID chunk, void* chunkData, siz
         close(fd);
         return compressedChunkLength;
     }
-    if(compressedChunkLength > totalChunkLength) {
+    if(compressedChunkLength + sizeof(ChunkHeader) > totalChunkLength) {
         // Haven't determined if we can just allocate a new 4KiB sector for the chunk
         // To avoid corrupting the region, let's just make the function fail and retry on another chunk that has
         // free space at the end
@@ -80,27 +190,26 @@ int overwriteChunk(const char* regionFolder, ChunkID chunk, void* chunkData, siz
         return INSUFFICIENT_SPACE_FOR_CHUNK;
     }
     header.length = __bswap_32((uint32_t)compressedChunkLength+1);
-    if(write(fd,&header,sizeof(ChunkHeader)) <= 0) {
+    if(pwrite(fd,&header,sizeof(ChunkHeader),chunkHeaderOffset) != sizeof(ChunkHeader)) {
         close(fd);
         free(compressedChunk);
         return WRITE_ERROR;
     }
-    ssize_t nWritten = 0;
-    size_t totalWritten = 0;
+    if(pwriteFully(fd,compressedChunk,compressedChunkLength,chunkHeaderOffset + sizeof(ChunkHeader)) < 0) {
+        close(fd);
+        free(compressedChunk);
+        return WRITE_ERROR;
+    }
+    free(compressedChunk);
 
-    while((nWritten = write(fd,compressedChunk+totalWritten,compressedChunkLength-totalWritten))) {
-        if(nWritten == -1) {
-            if(errno == EINTR) {
-                continue;
-            }
-            close(fd);
-            free(compressedChunk);
-            return WRITE_ERROR;
-        }
-        totalWritten += nWritten;
+    // Keep the timestamp table in step, it's how readers tell the chunk changed
+    uint32_t chunkTimestamp = __bswap_32((uint32_t)time(NULL));
+    if(pwrite(fd,&chunkTimestamp,sizeof(uint32_t),timestampOffset) != sizeof(uint32_t)) {
+        close(fd);
+        return WRITE_ERROR;
     }
+    // Closing the descriptor drops the locks
     close(fd);
-    free(compressedChunk);
     return SUCCESS;
 }
 
@@ -110,21 +219,31 @@ ssize_t loadChunk(const char* regionFolder, ChunkID chunk, void** chunkData) {
     relativeChunk.x = chunk.x & 31;
     relativeChunk.z = chunk.z & 31;
 
-    char* regionFilename = calloc(MAX_REGION_FILENAME_LENGTH + strlen(regionFolder),sizeof(char));
-    sprintf(regionFilename,"%s/r.%d.%d.mca",regionFolder,region.x,region.z);
+    char* regionFilename = getRegionFilename(regionFolder,region);
+    if(regionFilename == NULL) {
+        return MEMORY_ERROR;
+    }
 
     if(access(regionFilename,R_OK) == -1) {
+        free(regionFilename);
         return ACCESS_ERROR;
     }
 
     int fd = open(regionFilename,O_RDONLY);
+    free(regionFilename);
     if(fd == -1) {
         return OPEN_ERROR;
     }
-    free(regionFilename);
+
+    // Held until the data is read, so no writer can move or rewrite the chunk under us
+    off_t locationOffset = (relativeChunk.x + relativeChunk.z * CHUNK_OFFSET_LENGTH) * sizeof(uint32_t);
+    if(lockRegionRange(fd,F_RDLCK,locationOffset,sizeof(uint32_t)) != SUCCESS) {
+        close(fd);
+        return LOCK_ERROR;
+    }
 
     uint32_t chunkHeaderOffset;
-    if(pread(fd,&chunkHeaderOffset,sizeof(uint32_t),(relativeChunk.x + relativeChunk.z * CHUNK_OFFSET_LENGTH) * sizeof(uint32_t)) == -1) {
+    if(pread(fd,&chunkHeaderOffset,sizeof(uint32_t),locationOffset) != sizeof(uint32_t)) {
         close(fd);
         return READ_ERROR;
     }
@@ -135,37 +254,28 @@ ssize_t loadChunk(const char* regionFolder, ChunkID chunk, void** chunkData) {
         return CHUNK_NOT_PRESENT;
     }
 
-    if(lseek(fd,chunkHeaderOffset,SEEK_SET) == -1) {
-        close(fd);
-        return SEEK_ERROR;
-    }
-
     ChunkHeader header;
-    if(read(fd,&header,sizeof(ChunkHeader)) <= 0) {
+    if(pread(fd,&header,sizeof(ChunkHeader),chunkHeaderOffset) != sizeof(ChunkHeader)) {
         close(fd);
         return READ_ERROR;
     }
     header.length = __bswap_32(header.length);
-    ssize_t chunkLength = header.length;
     if((header.compressionType != COMPRESSION_TYPE_ZLIB && header.compressionType != COMPRESSION_TYPE_GZIP) || header.length == 0) {
-        close(fd); 
+        close(fd);
         return INVALID_HEADER;
     }
-    
+
+    // length counts the compression type byte as well
+    ssize_t chunkLength = header.length - 1;
     void* compressedChunk = calloc(chunkLength,sizeof(char));
-    ssize_t nRead = 0;
-    size_t totalRead = 0;
-    
-    while((nRead = read(fd,compressedChunk+totalRead,chunkLength-totalRead))) {
-        if(nRead == -1) {
-            if(errno == EINTR) {
-                continue;
-            }
-            close(fd);
-            free(compressedChunk);
-            return READ_ERROR;
-        }
-        totalRead += nRead;
+    if(compressedChunk == NULL) {
+        close(fd);
+        return MEMORY_ERROR;
+    }
+    if(preadFully(fd,compressedChunk,chunkLength,chunkHeaderOffset + sizeof(ChunkHeader)) != chunkLength) {
+        close(fd);
+        free(compressedChunk);
+        return READ_ERROR;
     }
     close(fd);
 
@@ -180,4 +290,4 @@ ssize_t loadChunk(const char* regionFolder, ChunkID chunk, void** chunkData) {
 
     *chunkData = decompressedChunk;
     return chunkLength;
-}
\ No newline at end of file
+}
@@ -1,6 +1,10 @@
 #ifndef _CHUNK_H
 #define _CHUNK_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // F_OFD_SETLKW
+#endif
+
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -10,6 +14,7 @@
 #include <string.h>
 #include <byteswap.h>
 #include <math.h>
+#include <time.h>
 
 #include "compression.h"
 #include "errors.h"
@@ -18,6 +23,17 @@
 #define CHUNKS_PER_REGION 32
 #define CHUNK_OFFSET_LENGTH 32
 #define CHUNK_SECTOR_SIZE 4096
+#define CHUNK_TIMESTAMP_TABLE_OFFSET CHUNK_SECTOR_SIZE
+#define REGION_HEADER_SIZE (2 * CHUNK_SECTOR_SIZE)
+
+// Open file description locks are owned by the descriptor rather than the process,
+// so they keep threads apart as well as processes. Elsewhere fall back to POSIX locks,
+// which only work between processes
+#ifdef F_OFD_SETLKW
+#define REGION_LOCK_WAIT F_OFD_SETLKW
+#else
+#define REGION_LOCK_WAIT F_SETLKW
+#endif
 
 // 58593 is the maximum number of regions containing 32 chunks in any direction
 // Thus, biggest filename is:
@@ -44,7 +60,14 @@ typedef struct __attribute__((packed)) ChunkHeader {
     uint8_t compressionType;
 } ChunkHeader;
 
+RegionID translateChunkToRegion(int x, int z);
 ChunkID translateCoordsToChunk(double x, double y, double z);
+char* getRegionFilename(const char* regionFolder, RegionID region);
+int readRegionHeader(const char* regionFolder, RegionID region, uint32_t* header);
+ssize_t inflateChunk(void* rawChunk, size_t rawLength, void** chunkData);
+int lockRegionRange(int fd, short type, off_t start, off_t length);
+ssize_t preadFully(int fd, void* data, size_t length, off_t offset);
+ssize_t pwriteFully(int fd, void* data, size_t length, off_t offset);
 int overwriteChunk(const char* regionFolder, ChunkID chunk, void* chunkData, size_t chunkLength);
 ssize_t loadChunk(const char* regionFolder, ChunkID chunk, void** chunkData);
 
@@ -9,12 +9,15 @@ enum GENERAL_ERROR_CODE {
     READ_ERROR = -4,
     SEEK_ERROR = -5,
     WRITE_ERROR = -6,
+    THREAD_ERROR = -7,
+    LOCK_ERROR = -8,
 };
 
 enum CHUNK_ERROR_CODE {
     INSUFFICIENT_SPACE_FOR_CHUNK = -10,
     CHUNK_NOT_PRESENT = -11,
     INVALID_HEADER = -12,
+    CHUNK_NOT_IN_REGION = -13,
 };
 
 enum COMPRESSION_ERROR_CODE {
@@ -24,4 +27,10 @@ enum COMPRESSION_ERROR_CODE {
     ZLIB_DEFLATE_ERROR = -23
 };
 
+enum NBT_ERROR_CODE {
+    INVALID_TAG_TYPE = -30,
+    TEXT_SYNTAX_ERROR = -31,
+    TAG_NOT_FOUND = -32,
+};
+
 #endif
\ No newline at end of file
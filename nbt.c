@@ -11,10 +11,20 @@ unsigned int parseList(void* addr, TagList* tl, uint8_t type);
 ssize_t parseCompound(void* addr, TagCompound* tc);
 ssize_t parsePayload(void* addr,Tag* t);
 ssize_t parseTag(void* addr, Tag* t);
-ssize_t composeCompound(TagCompound* tc, void** data);
-ssize_t composeList(uint8_t listType, TagList* tl, void** data);
-ssize_t composePayload(Tag t, void** data);
+ssize_t skipPayload(void* addr, uint8_t type);
+ssize_t writeCompound(TagCompound* tc, OutputSink* sink, int reuseSource);
+ssize_t writeList(uint8_t listType, TagList* tl, OutputSink* sink, int reuseSource);
+ssize_t writePayload(Tag t, OutputSink* sink, int reuseSource);
+ssize_t writeTagTo(Tag t, OutputSink* sink, int reuseSource);
+ssize_t writeTag(Tag t, OutputSink* sink);
+ssize_t rewriteTag(Tag t, OutputSink* sink);
+ssize_t composeTagFrom(Tag t, void** data, int reuseSource);
 ssize_t composeTag(Tag t, void** data);
+ssize_t recomposeTag(Tag t, void** data);
+int saveDB(const char* filename, Tag t);
+Tag* resolveTagPath(Tag* root, const char* path, int markDirty);
+Tag* editTag(Tag* root, const char* path);
+int setTagPayload(Tag* root, const char* path, void* payload, unsigned int payloadLength);
 
 ssize_t loadDB(const char* filename, void** data) {
     if(access(filename,R_OK) == -1) {
@@ -171,6 +181,9 @@ ssize_t parseCompound(void* addr, TagCompound* tc) {
 
 ssize_t parsePayload(void* addr,Tag* t) {
     void* pos = addr;
+    t->source = addr;
+    t->sourceLength = 0;
+    t->dirty = 0;
     t->payloadLength = getTypeSize(t->type); // initially, then particularly for lists/compounds/strings
     ssize_t compoundTagPos = 0;
     TagCompound* tc;
@@ -233,6 +246,7 @@ ssize_t parsePayload(void* addr,Tag* t) {
             pos += parseList(pos,tl,t->type);
             break;
     }
+    t->sourceLength = pos - addr;
     return pos - addr;
 }
 
@@ -260,143 +274,318 @@ ssize_t parseTag(void* addr, Tag* t) {
     return pos-addr;
 }
 
-ssize_t composeCompound(TagCompound* tc, void** data) {
-    size_t totalPayloadLength = 0;
-    void* totalPayload = calloc(1,sizeof(char));
-    unsigned int pos = 0;
-    size_t childTagPayloadLength = 0;
-    void* childTagPayload;
+ssize_t skipPayload(void* addr, uint8_t type) {
+    // Same walk as parsePayload, without building anything
+    void* pos = addr;
+    uint8_t listType;
+    uint32_t size;
+    ssize_t childPos;
+    switch(type) {
+        case TAG_STRING:
+            pos += sizeof(uint16_t) + __bswap_16(*((uint16_t*)pos));
+            break;
+        case TAG_BYTEARRAY:
+            size = __bswap_32(*((uint32_t*)pos));
+            pos += sizeof(uint32_t) + (size_t)size * sizeof(uint8_t);
+            break;
+        case TAG_INTARRAY:
+            size = __bswap_32(*((uint32_t*)pos));
+            pos += sizeof(uint32_t) + (size_t)size * sizeof(uint32_t);
+            break;
+        case TAG_LIST:
+            listType = *((uint8_t*)pos);
+            size = __bswap_32(*((uint32_t*)(pos + sizeof(uint8_t))));
+            pos += sizeof(uint8_t) + sizeof(uint32_t);
+            if(listType == TAG_END) {
+                break;
+            }
+            if(getTypeSize(listType)) {
+                pos += (size_t)size * getTypeSize(listType);
+                break;
+            }
+            for(uint32_t i = 0; i < size; ++i) {
+                childPos = skipPayload(pos,listType);
+                if(childPos < 0) {
+                    return childPos;
+                }
+                pos += childPos;
+            }
+            break;
+        case TAG_COMPOUND:
+            while(*((uint8_t*)pos) != TAG_END) {
+                uint8_t childType = *((uint8_t*)pos);
+                pos += sizeof(uint8_t);
+                pos += sizeof(uint16_t) + __bswap_16(*((uint16_t*)pos));
+                childPos = skipPayload(pos,childType);
+                if(childPos < 0) {
+                    return childPos;
+                }
+                pos += childPos;
+            }
+            pos += sizeof(uint8_t);
+            break;
+        default:
+            if(!getTypeSize(type)) {
+                return INVALID_TAG_TYPE;
+            }
+            pos += getTypeSize(type);
+            break;
+    }
+    return pos - addr;
+}
+
+ssize_t writeCompound(TagCompound* tc, OutputSink* sink, int reuseSource) {
+    size_t totalWritten = 0;
+    ssize_t nWritten = 0;
     for(int i = 0; i < tc->numTags; ++i) {
-        childTagPayloadLength = composeTag(tc->list[i],&childTagPayload);
-        totalPayloadLength += childTagPayloadLength;
-        void* newptr = realloc(totalPayload,totalPayloadLength);
-        if(newptr == NULL) {
-            free(totalPayload);
-            free(childTagPayload);
-            return MEMORY_ERROR;
+        nWritten = writeTagTo(tc->list[i],sink,reuseSource);
+        if(nWritten < 0) {
+            return nWritten;
         }
-        totalPayload = newptr;
-        memcpy(totalPayload+pos,childTagPayload,childTagPayloadLength);
-        free(childTagPayload);
-        pos += childTagPayloadLength;
-    }
-    void* newptr = realloc(totalPayload,++totalPayloadLength);
-    if(newptr == NULL) {
-        free(totalPayload);
-        return MEMORY_ERROR;
+        totalWritten += nWritten;
+    }
+    uint8_t end = TAG_END;
+    nWritten = writeSink(sink,&end,sizeof(uint8_t));
+    if(nWritten < 0) {
+        return nWritten;
     }
-    totalPayload = newptr;
-    ((uint8_t*)totalPayload)[pos] = 0x00;
-    *data = totalPayload;
-    return totalPayloadLength;
+    return totalWritten + nWritten;
 }
 
-ssize_t composeList(uint8_t listType, TagList* tl, void** data) {
-    size_t totalPayloadLength = 0;
+ssize_t writeList(uint8_t listType, TagList* tl, OutputSink* sink, int reuseSource) {
+    uint8_t listHeader[sizeof(uint8_t) + sizeof(uint32_t)];
+    size_t headerSize = 0;
     if(listType == TAG_LIST) {
-        totalPayloadLength += sizeof(uint8_t);
-    }
-    void* totalPayload = calloc(totalPayloadLength + sizeof(uint32_t),sizeof(char));
-    if(listType == TAG_LIST) {
-        ((uint8_t*)totalPayload)[0] = tl->type;
+        listHeader[headerSize++] = tl->type;
     }
     uint32_t u32 = __bswap_32(tl->size);
-    memcpy((uint8_t*)totalPayload + totalPayloadLength,&u32,sizeof(uint32_t));
-    totalPayloadLength += sizeof(uint32_t);
-    
-    unsigned int pos = totalPayloadLength;
-    size_t childTagPayloadLength = 0;
-    void* childTagPayload;
+    memcpy(listHeader + headerSize,&u32,sizeof(uint32_t));
+    headerSize += sizeof(uint32_t);
+
+    ssize_t nWritten = writeSink(sink,listHeader,headerSize);
+    if(nWritten < 0) {
+        return nWritten;
+    }
+    size_t totalWritten = nWritten;
     for(int i = 0; i < tl->size; ++i) {
-        childTagPayloadLength = composePayload(tl->list[i],&childTagPayload);
-        totalPayloadLength += childTagPayloadLength;
-        void* newptr = realloc(totalPayload,totalPayloadLength);
-        if(newptr == NULL) {
-            free(totalPayload);
-            free(childTagPayload);
-            return MEMORY_ERROR;
+        nWritten = writePayload(tl->list[i],sink,reuseSource);
+        if(nWritten < 0) {
+            return nWritten;
         }
-        totalPayload = newptr;
-        memcpy(totalPayload+pos,childTagPayload,childTagPayloadLength);
-        free(childTagPayload);
-        pos += childTagPayloadLength;
+        totalWritten += nWritten;
     }
-    
-    *data = totalPayload;
-    return totalPayloadLength;
+    return totalWritten;
 }
 
-ssize_t composePayload(Tag t, void** data) {
-    size_t payloadLength = getTypeSize(t.type); // initially, then particularly for lists/compounds/strings
-    void* payload;
+ssize_t writePayload(Tag t, OutputSink* sink, int reuseSource) {
+    if(reuseSource && !t.dirty && t.source != NULL) {
+        // Nothing in this subtree changed since it was parsed, the original bytes are still valid
+        return writeSink(sink,t.source,t.sourceLength);
+    }
 
+    ssize_t nWritten = 0;
     uint16_t u16 = 0;
     uint32_t u32 = 0;
     uint64_t u64 = 0;
     switch(t.type) {
         case TAG_BYTE:
-            payload = calloc(1,payloadLength);
-            memcpy(payload,t.payload,t.payloadLength);
+            nWritten = writeSink(sink,t.payload,t.payloadLength);
             break;
         case TAG_SHORT:
             u16 = __bswap_16(*(uint16_t*)t.payload);
-            payload = calloc(1,payloadLength);
-            memcpy(payload,&u16,t.payloadLength);
+            nWritten = writeSink(sink,&u16,sizeof(uint16_t));
             break;
         case TAG_INT:
         case TAG_FLOAT:
             u32 = __bswap_32(*(uint32_t*)t.payload);
-            payload = calloc(1,payloadLength);
-            memcpy(payload,&u32,t.payloadLength);
+            nWritten = writeSink(sink,&u32,sizeof(uint32_t));
             break;
         case TAG_LONG:
         case TAG_DOUBLE:
             u64 = __bswap_64(*(uint64_t*)t.payload);
-            payload = calloc(1,payloadLength);
-            memcpy(payload,&u64,t.payloadLength);
+            nWritten = writeSink(sink,&u64,sizeof(uint64_t));
             break;
         case TAG_STRING:
-            payloadLength = sizeof(uint16_t) + t.payloadLength;
-            payload = calloc(payloadLength,sizeof(char));
             u16 = __bswap_16((uint16_t)t.payloadLength);
-            memcpy(payload,&u16,sizeof(uint16_t));
-            memcpy(payload + sizeof(uint16_t),t.payload,t.payloadLength);
+            nWritten = writeSink(sink,&u16,sizeof(uint16_t));
+            if(nWritten < 0 || !t.payloadLength) {
+                break;
+            }
+            u32 = nWritten;
+            nWritten = writeSink(sink,t.payload,t.payloadLength);
+            if(nWritten >= 0) {
+                nWritten += u32;
+            }
             break;
         case TAG_COMPOUND:
-            payloadLength = composeCompound((TagCompound*)t.payload,&payload);
+            nWritten = writeCompound((TagCompound*)t.payload,sink,reuseSource);
             break;
         case TAG_LIST:
         case TAG_BYTEARRAY:
         case TAG_INTARRAY:
-            payloadLength = composeList(t.type,(TagList*)t.payload,&payload);
+            nWritten = writeList(t.type,(TagList*)t.payload,sink,reuseSource);
             break;
     }
+    return nWritten;
+}
+
+ssize_t writeTagTo(Tag t, OutputSink* sink, int reuseSource) {
+    uint8_t tagHeader[sizeof(uint8_t) + sizeof(uint16_t)];
+    tagHeader[0] = t.type;
+    uint16_t u16 = __bswap_16(t.nameLength);
+    memcpy(tagHeader + sizeof(uint8_t),&u16,sizeof(uint16_t));
+    ssize_t nWritten = writeSink(sink,tagHeader,sizeof(tagHeader));
+    if(nWritten < 0) {
+        return nWritten;
+    }
+    size_t totalWritten = nWritten;
+    if(t.nameLength) {
+        nWritten = writeSink(sink,t.name,t.nameLength);
+        if(nWritten < 0) {
+            return nWritten;
+        }
+        totalWritten += nWritten;
+    }
+    nWritten = writePayload(t,sink,reuseSource);
+    if(nWritten < 0) {
+        // Some error while writing payload
+        return nWritten;
+    }
+    return totalWritten + nWritten;
+}
+
+ssize_t writeTag(Tag t, OutputSink* sink) {
+    return writeTagTo(t,sink,0);
+}
 
-    *data = payload;
-    return payloadLength;
+ssize_t rewriteTag(Tag t, OutputSink* sink) {
+    return writeTagTo(t,sink,1);
+}
+
+ssize_t composeTagFrom(Tag t, void** data, int reuseSource) {
+    BufferSink bs;
+    initBufferSink(&bs);
+    ssize_t tagSize = writeTagTo(t,&bs.sink,reuseSource);
+    if(tagSize < 0) {
+        free(bs.data);
+        return tagSize;
+    }
+    *data = bs.data;
+    return tagSize;
 }
 
 ssize_t composeTag(Tag t, void** data) {
-    size_t headerSize = sizeof(uint8_t) + sizeof(uint16_t) + t.nameLength;
-    void* tagHeader = calloc(headerSize,sizeof(char));
-    ((uint8_t*)tagHeader)[0] = t.type;
-    uint16_t u16 = __bswap_16(t.nameLength);
-    memcpy(tagHeader+sizeof(uint8_t),&u16,sizeof(uint16_t));
-    memcpy(tagHeader+sizeof(uint8_t) + sizeof(uint16_t), t.name, t.nameLength);
-    void* tagPayload;
-    ssize_t payloadSize = composePayload(t,&tagPayload);
-    if(payloadSize < 0) {
-        // Some error while composing payload
-        return payloadSize;
-    }
-    void* tagData = realloc(tagHeader,headerSize + payloadSize);
-    if(tagData == NULL) {
-        free(tagHeader);
-        free(tagPayload);
-        return MEMORY_ERROR;
+    return composeTagFrom(t,data,0);
+}
+
+ssize_t recomposeTag(Tag t, void** data) {
+    // Only re-encodes what editTag/setTagPayload marked as dirty, the rest is copied from the buffer
+    // the tree was parsed from, so that buffer must still be around
+    return composeTagFrom(t,data,1);
+}
+
+int saveDB(const char* filename, Tag t) {
+    // Streams the tag through gzip straight into the file, without ever holding the whole document in memory
+    int fd = open(filename,O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if(fd == -1) {
+        return OPEN_ERROR;
+    }
+    FdSink fs;
+    initFdSink(&fs,fd);
+    DeflateSink ds;
+    int err = initDeflateSink(&ds,&fs.sink,0);
+    if(err != SUCCESS) {
+        close(fd);
+        return err;
+    }
+    ssize_t nWritten = writeTag(t,&ds.sink);
+    err = finishSink(&ds.sink);
+    if(nWritten < 0) {
+        err = nWritten;
+    }
+    if(close(fd) == -1 && err == SUCCESS) {
+        err = WRITE_ERROR;
+    }
+    return err;
+}
+
+Tag* resolveTagPath(Tag* root, const char* path, int markDirty) {
+    Tag* t = root;
+    const char* component = path;
+    while(t != NULL) {
+        if(markDirty) {
+            t->dirty = 1;
+        }
+        if(*component == '\0') {
+            return t;
+        }
+        const char* separator = strchr(component,TAG_PATH_SEPARATOR);
+        size_t componentLength = separator ? (size_t)(separator - component) : strlen(component);
+
+        Tag* next = NULL;
+        if(t->type == TAG_COMPOUND) {
+            TagCompound* tc = (TagCompound*)t->payload;
+            for(int i = 0; i < tc->numTags; ++i) {
+                if(tc->list[i].nameLength == componentLength && !memcmp(tc->list[i].name,component,componentLength)) {
+                    next = &tc->list[i];
+                    break;
+                }
+            }
+        } else if(t->type == TAG_LIST || t->type == TAG_BYTEARRAY || t->type == TAG_INTARRAY) {
+            TagList* tl = (TagList*)t->payload;
+            char* end;
+            unsigned long index = strtoul(component,&end,10);
+            if(end == component + componentLength && index < tl->size) {
+                next = &tl->list[index];
+            }
+        }
+
+        t = next;
+        component += componentLength;
+        if(*component == TAG_PATH_SEPARATOR) {
+            ++component;
+        }
+    }
+    return NULL;
+}
+
+Tag* editTag(Tag* root, const char* path) {
+    // Resolve first so a bad path doesn't leave half of it marked as dirty
+    if(resolveTagPath(root,path,0) == NULL) {
+        return NULL;
+    }
+    return resolveTagPath(root,path,1);
+}
+
+int setTagPayload(Tag* root, const char* path, void* payload, unsigned int payloadLength) {
+    // Takes a path rather than the tag itself, so the ancestors get marked as dirty too and
+    // recomposeTag can't copy the old bytes over the edit
+    Tag* t = resolveTagPath(root,path,0);
+    if(t == NULL) {
+        return TAG_NOT_FOUND;
+    }
+    if(t->type == TAG_STRING) {
+        if(payloadLength > UINT16_MAX) {
+            return INVALID_TAG_TYPE;
+        }
+    } else if(!getTypeSize(t->type) || getTypeSize(t->type) != payloadLength) {
+        // Lists and compounds are edited in place, after going through editTag
+        return INVALID_TAG_TYPE;
     }
-    memcpy(tagData + headerSize,tagPayload, payloadSize);
-    free(tagPayload);
-    *data = tagData;
-    return headerSize + payloadSize;
-}
\ No newline at end of file
+
+    void* newPayload = NULL;
+    if(payloadLength) {
+        newPayload = calloc(payloadLength,sizeof(char));
+        if(newPayload == NULL) {
+            return MEMORY_ERROR;
+        }
+        memcpy(newPayload,payload,payloadLength);
+    }
+    resolveTagPath(root,path,1);
+    if(t->payloadLength) {
+        free(t->payload);
+    }
+    t->payload = newPayload;
+    t->payloadLength = payloadLength;
+    return SUCCESS;
+}
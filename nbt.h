@@ -14,6 +14,7 @@
 #include <zlib.h>
 
 #include "errors.h"
+#include "sink.h"
 
 #ifndef REALLOC_SIZE
 #define REALLOC_SIZE 10
@@ -25,12 +26,21 @@
 
 #define GZIP_MAGIC 0x8B1F
 
+#define TAG_PATH_SEPARATOR '/'
+
+// source/sourceLength point at the payload bytes parseTag read this tag from, so
+// recomposeTag can copy untouched subtrees verbatim. Tags built by hand must
+// have source set to NULL. dirty is set by editTag and setTagPayload on every
+// tag along the path they are given.
 typedef struct Tag {
     uint8_t type;
     char* name;
     uint16_t nameLength;
     unsigned int payloadLength;
     void* payload;
+    void* source;
+    unsigned int sourceLength;
+    uint8_t dirty;
 } Tag;
 
 typedef struct TagList {
@@ -60,8 +70,16 @@ enum TAG {
 };
 
 ssize_t loadDB(const char* filename, void** data);
+int saveDB(const char* filename, Tag t);
 void destroyTag(Tag* t);
 ssize_t parseTag(void* addr, Tag* t);
+ssize_t skipPayload(void* addr, uint8_t type);
+size_t getTypeSize(uint8_t type);
 ssize_t composeTag(Tag t, void** data);
+ssize_t recomposeTag(Tag t, void** data);
+ssize_t writeTag(Tag t, OutputSink* sink);
+ssize_t rewriteTag(Tag t, OutputSink* sink);
+Tag* editTag(Tag* root, const char* path);
+int setTagPayload(Tag* root, const char* path, void* payload, unsigned int payloadLength);
 
 #endif
\ No newline at end of file
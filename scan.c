@@ -0,0 +1,325 @@
+#include "scan.h"
+
+typedef struct ScanManifestHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numRegions;
+} ScanManifestHeader;
+
+int parseRegionFilename(const char* filename, RegionID* region);
+int appendChunk(ChunkID** chunks, size_t* numChunks, RegionID region, unsigned int index);
+RegionManifestEntry* findManifestEntry(ScanManifest* manifest, RegionID region);
+ssize_t listChangedChunks(const char* regionFolder, time_t since, ChunkID** chunks);
+ssize_t listChunksChangedSinceManifest(const char* regionFolder, ScanManifest* manifest, ChunkID** chunks);
+int loadScanManifest(const char* manifestFile, ScanManifest* manifest);
+int saveScanManifest(const char* manifestFile, ScanManifest* manifest);
+void destroyScanManifest(ScanManifest* manifest);
+
+int parseRegionFilename(const char* filename, RegionID* region) {
+    int consumed = 0;
+    if(sscanf(filename,"r.%d.%d.mca%n",&region->x,&region->z,&consumed) != 2 || filename[consumed] != '\0') {
+        return 0;
+    }
+    return 1;
+}
+
+int appendChunk(ChunkID** chunks, size_t* numChunks, RegionID region, unsigned int index) {
+    // Grows a whole region's worth at a time, the list is only ever appended to
+    if(!(*numChunks % CHUNKS_IN_REGION)) {
+        void* newptr = reallocarray(*chunks,*numChunks + CHUNKS_IN_REGION,sizeof(ChunkID));
+        if(newptr == NULL) {
+            return MEMORY_ERROR;
+        }
+        *chunks = newptr;
+    }
+    ChunkID* chunk = &(*chunks)[(*numChunks)++];
+    chunk->x = region.x * CHUNKS_PER_REGION + index % CHUNK_OFFSET_LENGTH;
+    chunk->z = region.z * CHUNKS_PER_REGION + index / CHUNK_OFFSET_LENGTH;
+    return SUCCESS;
+}
+
+RegionManifestEntry* findManifestEntry(ScanManifest* manifest, RegionID region) {
+    for(unsigned int i = 0; i < manifest->numRegions; ++i) {
+        if(manifest->regions[i].region.x == region.x && manifest->regions[i].region.z == region.z) {
+            return &manifest->regions[i];
+        }
+    }
+    return NULL;
+}
+
+ssize_t listChangedChunks(const char* regionFolder, time_t since, ChunkID** chunks) {
+    // Timestamps only have one second resolution, so chunks written during the second since falls in
+    // count as changed too. Passing the time of the previous scan can't miss a write that raced it
+    DIR* dir = opendir(regionFolder);
+    if(dir == NULL) {
+        return OPEN_ERROR;
+    }
+
+    uint32_t* header = malloc(REGION_HEADER_SIZE);
+    if(header == NULL) {
+        closedir(dir);
+        return MEMORY_ERROR;
+    }
+    ChunkID* changed = NULL;
+    size_t numChanged = 0;
+    int err = SUCCESS;
+
+    struct dirent* entry;
+    while(err == SUCCESS && (entry = readdir(dir)) != NULL) {
+        RegionID region;
+        if(!parseRegionFilename(entry->d_name,&region)) {
+            continue;
+        }
+        char* regionFilename = getRegionFilename(regionFolder,region);
+        if(regionFilename == NULL) {
+            err = MEMORY_ERROR;
+            break;
+        }
+        struct stat sb;
+        int statErr = stat(regionFilename,&sb);
+        free(regionFilename);
+        if(statErr == -1 || sb.st_mtime < since || sb.st_size < REGION_HEADER_SIZE) {
+            // Nothing in a region can be newer than the file itself, and one without a full header has no chunks
+            continue;
+        }
+
+        err = readRegionHeader(regionFolder,region,header);
+        if(err != SUCCESS) {
+            // A region we can't read is skipped, not a reason to give up on the whole folder
+            if(err == MEMORY_ERROR) {
+                break;
+            }
+            err = SUCCESS;
+            continue;
+        }
+        for(unsigned int i = 0; i < CHUNKS_IN_REGION && err == SUCCESS; ++i) {
+            if(header[i] != 0 && (time_t)__bswap_32(header[CHUNKS_IN_REGION + i]) >= since) {
+                err = appendChunk(&changed,&numChanged,region,i);
+            }
+        }
+    }
+    closedir(dir);
+    free(header);
+
+    if(err != SUCCESS) {
+        free(changed);
+        return err;
+    }
+    *chunks = changed;
+    return numChanged;
+}
+
+ssize_t listChunksChangedSinceManifest(const char* regionFolder, ScanManifest* manifest, ChunkID** chunks) {
+    // Brings manifest up to date with the folder as it goes, save it once the chunks have been processed
+    DIR* dir = opendir(regionFolder);
+    if(dir == NULL) {
+        return OPEN_ERROR;
+    }
+
+    unsigned int numKnownRegions = manifest->numRegions;
+    uint8_t* seen = calloc(numKnownRegions + 1,sizeof(uint8_t));
+    uint32_t* header = malloc(REGION_HEADER_SIZE);
+    if(seen == NULL || header == NULL) {
+        free(seen);
+        free(header);
+        closedir(dir);
+        return MEMORY_ERROR;
+    }
+    ChunkID* changed = NULL;
+    size_t numChanged = 0;
+    int err = SUCCESS;
+
+    struct dirent* entry;
+    while(err == SUCCESS && (entry = readdir(dir)) != NULL) {
+        RegionID region;
+        if(!parseRegionFilename(entry->d_name,&region)) {
+            continue;
+        }
+        char* regionFilename = getRegionFilename(regionFolder,region);
+        if(regionFilename == NULL) {
+            err = MEMORY_ERROR;
+            break;
+        }
+        struct stat sb;
+        int statErr = stat(regionFilename,&sb);
+        free(regionFilename);
+        if(statErr == -1) {
+            continue;
+        }
+
+        RegionManifestEntry* known = findManifestEntry(manifest,region);
+        if(known != NULL) {
+            if(known - manifest->regions < numKnownRegions) {
+                seen[known - manifest->regions] = 1;
+            }
+            if(known->mtimeSec == sb.st_mtim.tv_sec && known->mtimeNsec == sb.st_mtim.tv_nsec) {
+                continue;
+            }
+        }
+
+        if(sb.st_size < REGION_HEADER_SIZE) {
+            // Minecraft leaves empty region files behind, they have no chunks but their mtime is still recorded
+            memset(header,0,REGION_HEADER_SIZE);
+        } else {
+            err = readRegionHeader(regionFolder,region,header);
+            if(err != SUCCESS) {
+                // Skipped without updating the manifest, so it's looked at again next time
+                if(err == MEMORY_ERROR) {
+                    break;
+                }
+                err = SUCCESS;
+                continue;
+            }
+        }
+        for(unsigned int i = 0; i < CHUNKS_IN_REGION && err == SUCCESS; ++i) {
+            if(header[i] == 0) {
+                continue;
+            }
+            // overwriteChunk keeps the location entry, and a rewrite in the same second as the last scan
+            // keeps the timestamp too. Anything stamped at or after that scan's mtime may have changed
+            if(known == NULL || known->header[i] != header[i] || known->header[CHUNKS_IN_REGION + i] != header[CHUNKS_IN_REGION + i]
+               || (int64_t)__bswap_32(header[CHUNKS_IN_REGION + i]) >= known->mtimeSec) {
+                err = appendChunk(&changed,&numChanged,region,i);
+            }
+        }
+        if(err != SUCCESS) {
+            break;
+        }
+
+        if(known == NULL) {
+            void* newptr = reallocarray(manifest->regions,manifest->numRegions + 1,sizeof(RegionManifestEntry));
+            if(newptr == NULL) {
+                err = MEMORY_ERROR;
+                break;
+            }
+            manifest->regions = newptr;
+            known = &manifest->regions[manifest->numRegions++];
+            known->region = region;
+        }
+        known->mtimeSec = sb.st_mtim.tv_sec;
+        known->mtimeNsec = sb.st_mtim.tv_nsec;
+        memcpy(known->header,header,REGION_HEADER_SIZE);
+    }
+    closedir(dir);
+    free(header);
+
+    if(err != SUCCESS) {
+        free(seen);
+        free(changed);
+        return err;
+    }
+
+    // Forget about regions that have been deleted since the last scan
+    unsigned int kept = 0;
+    for(unsigned int i = 0; i < manifest->numRegions; ++i) {
+        if(i >= numKnownRegions || seen[i]) {
+            manifest->regions[kept++] = manifest->regions[i];
+        }
+    }
+    manifest->numRegions = kept;
+    free(seen);
+
+    *chunks = changed;
+    return numChanged;
+}
+
+int loadScanManifest(const char* manifestFile, ScanManifest* manifest) {
+    manifest->numRegions = 0;
+    manifest->regions = NULL;
+
+    int fd = open(manifestFile,O_RDONLY);
+    if(fd == -1) {
+        // First run, everything counts as changed
+        return (errno == ENOENT) ? SUCCESS : OPEN_ERROR;
+    }
+
+    ScanManifestHeader header;
+    if(read(fd,&header,sizeof(ScanManifestHeader)) != sizeof(ScanManifestHeader) || header.magic != SCAN_MANIFEST_MAGIC || header.version != SCAN_MANIFEST_VERSION) {
+        close(fd);
+        return INVALID_HEADER;
+    }
+
+    size_t length = (size_t)header.numRegions * sizeof(RegionManifestEntry);
+    RegionManifestEntry* regions = malloc(length ? length : 1);
+    if(regions == NULL) {
+        close(fd);
+        return MEMORY_ERROR;
+    }
+    ssize_t nRead = 0;
+    size_t totalRead = 0;
+    while(totalRead < length && (nRead = read(fd,(uint8_t*)regions + totalRead,length - totalRead))) {
+        if(nRead == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        totalRead += nRead;
+    }
+    close(fd);
+    if(totalRead != length) {
+        free(regions);
+        return READ_ERROR;
+    }
+
+    manifest->numRegions = header.numRegions;
+    manifest->regions = regions;
+    return SUCCESS;
+}
+
+int saveScanManifest(const char* manifestFile, ScanManifest* manifest) {
+    // Written next to the old one and renamed over it, so a crash never leaves a truncated manifest behind
+    char* tmpFile = calloc(strlen(manifestFile) + sizeof(".tmp"),sizeof(char));
+    if(tmpFile == NULL) {
+        return MEMORY_ERROR;
+    }
+    sprintf(tmpFile,"%s.tmp",manifestFile);
+
+    int fd = open(tmpFile,O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if(fd == -1) {
+        free(tmpFile);
+        return OPEN_ERROR;
+    }
+
+    ScanManifestHeader header;
+    header.magic = SCAN_MANIFEST_MAGIC;
+    header.version = SCAN_MANIFEST_VERSION;
+    header.numRegions = manifest->numRegions;
+
+    int err = SUCCESS;
+    if(write(fd,&header,sizeof(ScanManifestHeader)) != sizeof(ScanManifestHeader)) {
+        err = WRITE_ERROR;
+    }
+    size_t length = (size_t)manifest->numRegions * sizeof(RegionManifestEntry);
+    ssize_t nWritten = 0;
+    size_t totalWritten = 0;
+    while(err == SUCCESS && totalWritten < length) {
+        nWritten = write(fd,(uint8_t*)manifest->regions + totalWritten,length - totalWritten);
+        if(nWritten == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            err = WRITE_ERROR;
+            break;
+        }
+        totalWritten += nWritten;
+    }
+    if(err == SUCCESS && fsync(fd) == -1) {
+        err = WRITE_ERROR;
+    }
+    close(fd);
+    if(err == SUCCESS && rename(tmpFile,manifestFile) == -1) {
+        err = WRITE_ERROR;
+    }
+    if(err != SUCCESS) {
+        unlink(tmpFile);
+    }
+    free(tmpFile);
+    return err;
+}
+
+void destroyScanManifest(ScanManifest* manifest) {
+    free(manifest->regions);
+    manifest->regions = NULL;
+    manifest->numRegions = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <byteswap.h>
+#include <sys/stat.h>
+
+#include "chunk.h"
+#include "errors.h"
+
+#define SCAN_MANIFEST_MAGIC 0x4D54424E // "NBTM"
+#define SCAN_MANIFEST_VERSION 1
+#define CHUNKS_IN_REGION (CHUNKS_PER_REGION * CHUNKS_PER_REGION)
+
+// Region header as it was the last time a scan went through it. header holds
+// the raw location and timestamp tables, exactly as they are on disk
+typedef struct RegionManifestEntry {
+    RegionID region;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint32_t header[REGION_HEADER_SIZE / sizeof(uint32_t)];
+} RegionManifestEntry;
+
+typedef struct ScanManifest {
+    unsigned int numRegions;
+    RegionManifestEntry* regions;
+} ScanManifest;
+
+ssize_t listChangedChunks(const char* regionFolder, time_t since, ChunkID** chunks);
+ssize_t listChunksChangedSinceManifest(const char* regionFolder, ScanManifest* manifest, ChunkID** chunks);
+int loadScanManifest(const char* manifestFile, ScanManifest* manifest);
+int saveScanManifest(const char* manifestFile, ScanManifest* manifest);
+void destroyScanManifest(ScanManifest* manifest);
+
+#endif
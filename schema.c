@@ -0,0 +1,188 @@
+#include "schema.h"
+
+uint32_t hashFieldName(const char* name, size_t nameLength);
+int compileSchema(Schema* schema, const SchemaField* fields, unsigned int numFields);
+void destroySchema(Schema* schema);
+const SchemaField* lookupField(const Schema* schema, const char* name, uint16_t nameLength);
+ssize_t decodeFieldPayload(void* addr, uint8_t type, const SchemaField* field, void* out);
+ssize_t decodeCompoundSchema(void* addr, const Schema* schema, void* out);
+ssize_t decodeSchema(void* addr, const Schema* schema, void* out);
+
+uint32_t hashFieldName(const char* name, size_t nameLength) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < nameLength; ++i) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+int compileSchema(Schema* schema, const SchemaField* fields, unsigned int numFields) {
+    for(unsigned int i = 0; i < numFields; ++i) {
+        uint8_t type = fields[i].type;
+        if(getTypeSize(type)) {
+            if(fields[i].size != getTypeSize(type)) {
+                return INVALID_TAG_TYPE;
+            }
+        } else if(type == TAG_COMPOUND) {
+            if(fields[i].nested == NULL) {
+                return INVALID_TAG_TYPE;
+            }
+        } else if(type != TAG_STRING && type != TAG_BYTEARRAY && type != TAG_INTARRAY) {
+            return INVALID_TAG_TYPE;
+        }
+        if(strlen(fields[i].name) > UINT16_MAX) {
+            return INVALID_TAG_TYPE;
+        }
+    }
+
+    // Power of two, at most half full
+    unsigned int numSlots = 1;
+    while(numSlots < numFields * 2) {
+        numSlots <<= 1;
+    }
+    uint16_t* slots = calloc(numSlots,sizeof(uint16_t));
+    uint16_t* nameLengths = calloc(numFields ? numFields : 1,sizeof(uint16_t));
+    if(slots == NULL || nameLengths == NULL) {
+        free(slots);
+        free(nameLengths);
+        return MEMORY_ERROR;
+    }
+    for(unsigned int i = 0; i < numFields; ++i) {
+        nameLengths[i] = strlen(fields[i].name);
+        unsigned int slot = hashFieldName(fields[i].name,nameLengths[i]) & (numSlots - 1);
+        while(slots[slot]) {
+            slot = (slot + 1) & (numSlots - 1);
+        }
+        // 0 marks an empty slot
+        slots[slot] = i + 1;
+    }
+
+    schema->fields = fields;
+    schema->numFields = numFields;
+    schema->numSlots = numSlots;
+    schema->nameLengths = nameLengths;
+    schema->slots = slots;
+    return SUCCESS;
+}
+
+void destroySchema(Schema* schema) {
+    free(schema->slots);
+    free(schema->nameLengths);
+    schema->slots = NULL;
+    schema->nameLengths = NULL;
+}
+
+const SchemaField* lookupField(const Schema* schema, const char* name, uint16_t nameLength) {
+    unsigned int slot = hashFieldName(name,nameLength) & (schema->numSlots - 1);
+    while(schema->slots[slot]) {
+        unsigned int i = schema->slots[slot] - 1;
+        if(schema->nameLengths[i] == nameLength && !memcmp(schema->fields[i].name,name,nameLength)) {
+            return &schema->fields[i];
+        }
+        slot = (slot + 1) & (schema->numSlots - 1);
+    }
+    return NULL;
+}
+
+ssize_t decodeFieldPayload(void* addr, uint8_t type, const SchemaField* field, void* out) {
+    void* pos = addr;
+    uint8_t* dest = (uint8_t*)out + field->offset;
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    uint64_t u64 = 0;
+    size_t length = 0;
+    switch(type) {
+        case TAG_BYTE:
+            *dest = *((uint8_t*)pos);
+            pos += sizeof(uint8_t);
+            break;
+        case TAG_SHORT:
+            u16 = __bswap_16(*(uint16_t*)pos);
+            memcpy(dest,&u16,sizeof(uint16_t));
+            pos += sizeof(uint16_t);
+            break;
+        case TAG_INT:
+        case TAG_FLOAT:
+            u32 = __bswap_32(*(uint32_t*)pos);
+            memcpy(dest,&u32,sizeof(uint32_t));
+            pos += sizeof(uint32_t);
+            break;
+        case TAG_LONG:
+        case TAG_DOUBLE:
+            u64 = __bswap_64(*(uint64_t*)pos);
+            memcpy(dest,&u64,sizeof(uint64_t));
+            pos += sizeof(uint64_t);
+            break;
+        case TAG_STRING:
+            length = __bswap_16(*((uint16_t*)pos));
+            pos += sizeof(uint16_t);
+            if(field->size) {
+                size_t copied = (length < field->size - 1) ? length : field->size - 1;
+                memcpy(dest,pos,copied);
+                dest[copied] = '\0';
+            }
+            pos += length;
+            break;
+        case TAG_BYTEARRAY:
+            length = __bswap_32(*((uint32_t*)pos));
+            pos += sizeof(uint32_t);
+            memcpy(dest,pos,(length < field->size) ? length : field->size);
+            pos += length;
+            break;
+        case TAG_INTARRAY:
+            length = __bswap_32(*((uint32_t*)pos));
+            pos += sizeof(uint32_t);
+            for(size_t i = 0; i < length && (i + 1) * sizeof(uint32_t) <= field->size; ++i) {
+                u32 = __bswap_32(((uint32_t*)pos)[i]);
+                memcpy(dest + i * sizeof(uint32_t),&u32,sizeof(uint32_t));
+            }
+            pos += length * sizeof(uint32_t);
+            break;
+        case TAG_COMPOUND:
+            return decodeCompoundSchema(pos,field->nested,dest);
+    }
+    return pos - addr;
+}
+
+ssize_t decodeCompoundSchema(void* addr, const Schema* schema, void* out) {
+    void* pos = addr;
+    uint8_t type;
+    while((type = *((uint8_t*)pos)) != TAG_END) {
+        pos += sizeof(uint8_t);
+        uint16_t nameLength = __bswap_16(*((uint16_t*)pos));
+        const char* name = (const char*)pos + sizeof(uint16_t);
+        pos += sizeof(uint16_t) + nameLength;
+
+        const SchemaField* field = lookupField(schema,name,nameLength);
+        ssize_t payloadPos;
+        if(field != NULL && field->type == type) {
+            payloadPos = decodeFieldPayload(pos,type,field,out);
+        } else {
+            // Unknown field, or known but not the type we were told to expect
+            payloadPos = skipPayload(pos,type);
+        }
+        if(payloadPos < 0) {
+            return payloadPos;
+        }
+        pos += payloadPos;
+    }
+    pos += sizeof(uint8_t);
+    return pos - addr;
+}
+
+ssize_t decodeSchema(void* addr, const Schema* schema, void* out) {
+    // addr points at a whole tag, as with parseTag. Only compounds can be decoded into a struct
+    void* pos = addr;
+    if(*((uint8_t*)pos) != TAG_COMPOUND) {
+        return INVALID_TAG_TYPE;
+    }
+    pos += sizeof(uint8_t);
+    pos += sizeof(uint16_t) + __bswap_16(*((uint16_t*)pos));
+    ssize_t payloadPos = decodeCompoundSchema(pos,schema,out);
+    if(payloadPos < 0) {
+        return payloadPos;
+    }
+    pos += payloadPos;
+    return pos - addr;
+}
@@ -0,0 +1,46 @@
+#ifndef _SCHEMA_H
+#define _SCHEMA_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <byteswap.h>
+
+#include "nbt.h"
+#include "errors.h"
+
+// One entry per field the caller cares about. Everything else in the
+// compound is skipped over without being decoded
+//   TAG_BYTE..TAG_DOUBLE: member must be exactly the size of the tag type
+//   TAG_STRING: member is a char array, truncated and always NUL terminated
+//   TAG_BYTEARRAY/TAG_INTARRAY: member is a fixed size array, extra elements are dropped
+//   TAG_COMPOUND: decoded into member with the nested schema
+typedef struct SchemaField {
+    const char* name;
+    uint8_t type;
+    size_t offset;
+    size_t size;
+    const struct Schema* nested;
+} SchemaField;
+
+#define SCHEMA_FIELD(tagName, tagType, structType, member) \
+    { (tagName), (tagType), offsetof(structType, member), sizeof(((structType*)0)->member), NULL }
+#define SCHEMA_COMPOUND(tagName, structType, member, nestedSchema) \
+    { (tagName), TAG_COMPOUND, offsetof(structType, member), sizeof(((structType*)0)->member), (nestedSchema) }
+
+// Fields hashed by name into an open addressed table, so each tag in the
+// input costs one hash and at most a couple of probes to dispatch
+typedef struct Schema {
+    const SchemaField* fields;
+    unsigned int numFields;
+    unsigned int numSlots;
+    uint16_t* nameLengths;
+    uint16_t* slots;
+} Schema;
+
+int compileSchema(Schema* schema, const SchemaField* fields, unsigned int numFields);
+void destroySchema(Schema* schema);
+ssize_t decodeSchema(void* addr, const Schema* schema, void* out);
+
+#endif
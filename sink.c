@@ -0,0 +1,161 @@
+#include "sink.h"
+
+ssize_t writeSink(OutputSink* sink, const void* data, size_t length);
+int finishSink(OutputSink* sink);
+ssize_t writeBufferSink(OutputSink* sink, const void* data, size_t length);
+int finishBufferSink(OutputSink* sink);
+void initBufferSink(BufferSink* bs);
+void resetBufferSink(BufferSink* bs);
+ssize_t writeFdSink(OutputSink* sink, const void* data, size_t length);
+int finishFdSink(OutputSink* sink);
+void initFdSink(FdSink* fs, int fd);
+int flushDeflateSink(DeflateSink* ds, int flush);
+ssize_t writeDeflateSink(OutputSink* sink, const void* data, size_t length);
+int finishDeflateSink(OutputSink* sink);
+int initDeflateSink(DeflateSink* ds, OutputSink* next, int headerless);
+
+ssize_t writeSink(OutputSink* sink, const void* data, size_t length) {
+    return sink->write(sink,data,length);
+}
+
+int finishSink(OutputSink* sink) {
+    return sink->finish(sink);
+}
+
+ssize_t writeBufferSink(OutputSink* sink, const void* data, size_t length) {
+    BufferSink* bs = (BufferSink*)sink;
+    if(bs->length + length > bs->capacity) {
+        size_t capacity = bs->capacity ? bs->capacity : SINK_BUFFER_SIZE;
+        while(bs->length + length > capacity) {
+            capacity *= 2;
+        }
+        void* newptr = realloc(bs->data,capacity);
+        if(newptr == NULL) {
+            return MEMORY_ERROR;
+        }
+        bs->data = newptr;
+        bs->capacity = capacity;
+    }
+    memcpy((uint8_t*)bs->data + bs->length,data,length);
+    bs->length += length;
+    return length;
+}
+
+int finishBufferSink(OutputSink* sink) {
+    return SUCCESS;
+}
+
+void initBufferSink(BufferSink* bs) {
+    bs->sink.write = writeBufferSink;
+    bs->sink.finish = finishBufferSink;
+    bs->data = NULL;
+    bs->length = 0;
+    bs->capacity = 0;
+}
+
+void resetBufferSink(BufferSink* bs) {
+    // Keeps the allocation around for the next document
+    bs->length = 0;
+}
+
+ssize_t writeFdSink(OutputSink* sink, const void* data, size_t length) {
+    FdSink* fs = (FdSink*)sink;
+    ssize_t nWritten = 0;
+    size_t totalWritten = 0;
+    while(totalWritten < length) {
+        nWritten = write(fs->fd,(const uint8_t*)data + totalWritten,length - totalWritten);
+        if(nWritten == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return WRITE_ERROR;
+        }
+        totalWritten += nWritten;
+    }
+    return totalWritten;
+}
+
+int finishFdSink(OutputSink* sink) {
+    return SUCCESS;
+}
+
+void initFdSink(FdSink* fs, int fd) {
+    fs->sink.write = writeFdSink;
+    fs->sink.finish = finishFdSink;
+    fs->fd = fd;
+}
+
+int flushDeflateSink(DeflateSink* ds, int flush) {
+    int err = Z_OK;
+    do {
+        ds->strm.next_out = ds->out;
+        ds->strm.avail_out = SINK_BUFFER_SIZE;
+        err = deflate(&ds->strm,flush);
+        if(err == Z_STREAM_ERROR) {
+            return ZLIB_DEFLATE_ERROR;
+        }
+        size_t produced = SINK_BUFFER_SIZE - ds->strm.avail_out;
+        if(produced) {
+            ssize_t nWritten = writeSink(ds->next,ds->out,produced);
+            if(nWritten < 0) {
+                return nWritten;
+            }
+        }
+    } while(ds->strm.avail_out == 0 || (flush == Z_FINISH && err != Z_STREAM_END));
+    return SUCCESS;
+}
+
+ssize_t writeDeflateSink(OutputSink* sink, const void* data, size_t length) {
+    DeflateSink* ds = (DeflateSink*)sink;
+    ds->strm.next_in = (Bytef*)data;
+    ds->strm.avail_in = length;
+    int err = flushDeflateSink(ds,Z_NO_FLUSH);
+    if(err != SUCCESS) {
+        return err;
+    }
+    return length;
+}
+
+int finishDeflateSink(OutputSink* sink) {
+    DeflateSink* ds = (DeflateSink*)sink;
+    ds->strm.next_in = Z_NULL;
+    ds->strm.avail_in = 0;
+    int err = flushDeflateSink(ds,Z_FINISH);
+    if(deflateEnd(&ds->strm) != Z_OK && err == SUCCESS) {
+        err = ZLIB_STREAM_FREE_ERROR;
+    }
+    if(err != SUCCESS) {
+        return err;
+    }
+    return finishSink(ds->next);
+}
+
+int initDeflateSink(DeflateSink* ds, OutputSink* next, int headerless) {
+    ds->sink.write = writeDeflateSink;
+    ds->sink.finish = finishDeflateSink;
+    ds->next = next;
+    ds->strm.zalloc = Z_NULL;
+    ds->strm.zfree = Z_NULL;
+    ds->strm.opaque = Z_NULL;
+
+    int err = Z_OK;
+    if(headerless) {
+        err = deflateInit(&ds->strm, Z_DEFAULT_COMPRESSION);
+    } else {
+        err = deflateInit2(&ds->strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16+MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    }
+    if(err != Z_OK) {
+        return ZLIB_STREAM_INIT_ERROR;
+    }
+
+    if(!headerless) {
+        // Same OS Flag as deflateGzip: "FAT filesystem (MS-DOS, OS/2, NT/Win32)"
+        memset(&ds->gzHeader,0,sizeof(gz_header));
+        ds->gzHeader.os = 0x00;
+        if(deflateSetHeader(&ds->strm,&ds->gzHeader) != Z_OK) {
+            deflateEnd(&ds->strm);
+            return ZLIB_STREAM_INIT_ERROR;
+        }
+    }
+    return SUCCESS;
+}
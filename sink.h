@@ -0,0 +1,55 @@
+#ifndef _SINK_H
+#define _SINK_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "errors.h"
+
+#ifndef SINK_BUFFER_SIZE
+#define SINK_BUFFER_SIZE 4096
+#endif
+
+// Somewhere serialized bytes can be streamed to. Every concrete sink starts
+// with an OutputSink, so a pointer to it can be passed around as OutputSink*.
+typedef struct OutputSink {
+    ssize_t (*write)(struct OutputSink* sink, const void* data, size_t length);
+    int (*finish)(struct OutputSink* sink);
+} OutputSink;
+
+// Growable memory buffer. data belongs to the caller once writing is done
+typedef struct BufferSink {
+    OutputSink sink;
+    void* data;
+    size_t length;
+    size_t capacity;
+} BufferSink;
+
+// Plain file descriptor. The caller opens and closes fd
+typedef struct FdSink {
+    OutputSink sink;
+    int fd;
+} FdSink;
+
+// Compresses everything written to it and passes the result on to next,
+// SINK_BUFFER_SIZE bytes at a time
+typedef struct DeflateSink {
+    OutputSink sink;
+    OutputSink* next;
+    z_stream strm;
+    gz_header gzHeader;
+    uint8_t out[SINK_BUFFER_SIZE];
+} DeflateSink;
+
+ssize_t writeSink(OutputSink* sink, const void* data, size_t length);
+int finishSink(OutputSink* sink);
+void initBufferSink(BufferSink* bs);
+void resetBufferSink(BufferSink* bs);
+void initFdSink(FdSink* fs, int fd);
+int initDeflateSink(DeflateSink* ds, OutputSink* next, int headerless);
+
+#endif
@@ -0,0 +1,795 @@
+#include "text.h"
+
+void flushText(TextWriter* w);
+void emitText(TextWriter* w, const char* text, size_t length);
+void emitChar(TextWriter* w, char c);
+void emitInteger(TextWriter* w, int64_t value);
+void emitReal(TextWriter* w, double value, int single);
+void emitString(TextWriter* w, const char* s, size_t length);
+void emitKey(TextWriter* w, const char* name, size_t nameLength);
+ssize_t exportPayload(TextWriter* w, void* addr, uint8_t type, unsigned int depth);
+ssize_t exportText(void* addr, int format, OutputSink* sink);
+int isTokenChar(char c);
+void skipWhitespace(TextReader* r);
+int writeOut(TextReader* r, const void* data, size_t length);
+int importString(TextReader* r);
+int importToken(TextReader* r);
+int importArray(TextReader* r, uint8_t arrayType);
+int numberRank(uint8_t type);
+int widenNumbers(TextReader* r, size_t start, uint32_t count, uint8_t from, uint8_t to);
+int importList(TextReader* r);
+int importCompound(TextReader* r);
+int importValue(TextReader* r);
+ssize_t importText(const char* text, size_t textLength, int format, void** data);
+
+void flushText(TextWriter* w) {
+    if(w->err >= 0 && w->used) {
+        ssize_t nWritten = writeSink(w->sink,w->buffer,w->used);
+        if(nWritten < 0) {
+            w->err = nWritten;
+        }
+    }
+    w->used = 0;
+}
+
+void emitText(TextWriter* w, const char* text, size_t length) {
+    if(w->used + length > SINK_BUFFER_SIZE) {
+        flushText(w);
+        if(length > SINK_BUFFER_SIZE) {
+            // Too big to stage, hand it over as it is
+            if(w->err >= 0) {
+                ssize_t nWritten = writeSink(w->sink,text,length);
+                if(nWritten < 0) {
+                    w->err = nWritten;
+                }
+            }
+            return;
+        }
+    }
+    memcpy(w->buffer + w->used,text,length);
+    w->used += length;
+}
+
+void emitChar(TextWriter* w, char c) {
+    if(w->used == SINK_BUFFER_SIZE) {
+        flushText(w);
+    }
+    w->buffer[w->used++] = c;
+}
+
+void emitInteger(TextWriter* w, int64_t value) {
+    // Digits are produced backwards into a scratch buffer, no printf involved
+    char digits[21];
+    char* p = digits + sizeof(digits);
+    uint64_t magnitude = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while(magnitude);
+    if(value < 0) {
+        *--p = '-';
+    }
+    emitText(w,p,digits + sizeof(digits) - p);
+}
+
+void emitReal(TextWriter* w, double value, int single) {
+    if(!isfinite(value) && w->format == TEXT_FORMAT_JSON) {
+        emitText(w,"null",4);
+        return;
+    }
+    if(fabs(value) < 1e15 && value == (double)(int64_t)value && !(value == 0 && signbit(value))) {
+        // Whole numbers, by far the most common case, go through the integer path
+        emitInteger(w,(int64_t)value);
+        emitText(w,".0",2);
+        return;
+    }
+    // Try the short form first and only fall back to full precision if it doesn't read back the same.
+    // nan and inf come out in a form strtod reads back too
+    char number[32];
+    int length = snprintf(number,sizeof(number),"%.*g",single ? 6 : 15,value);
+    double parsed = strtod(number,NULL);
+    if(single ? ((float)parsed != (float)value) : (parsed != value)) {
+        length = snprintf(number,sizeof(number),"%.*g",single ? 9 : 17,value);
+    }
+    if(strpbrk(number,".eni") == NULL) {
+        // Keep it from reading back as an integer
+        memcpy(number + length,".0",3);
+        length += 2;
+    }
+    emitText(w,number,length);
+}
+
+void emitString(TextWriter* w, const char* s, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    emitChar(w,'"');
+    size_t runStart = 0;
+    for(size_t i = 0; i < length; ++i) {
+        uint8_t c = s[i];
+        if(c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // Copy the clean run in one go, then the escape
+        emitText(w,s + runStart,i - runStart);
+        runStart = i + 1;
+        if(c == '"' || c == '\\') {
+            char escape[2] = {'\\',c};
+            emitText(w,escape,2);
+        } else if(c == '\n') {
+            emitText(w,"\\n",2);
+        } else if(c == '\t') {
+            emitText(w,"\\t",2);
+        } else if(c == '\r') {
+            emitText(w,"\\r",2);
+        } else {
+            char escape[6] = {'\\','u','0','0',hex[c >> 4],hex[c & 0xF]};
+            emitText(w,escape,6);
+        }
+    }
+    emitText(w,s + runStart,length - runStart);
+    emitChar(w,'"');
+}
+
+void emitKey(TextWriter* w, const char* name, size_t nameLength) {
+    int bare = (w->format == TEXT_FORMAT_SNBT && nameLength);
+    for(size_t i = 0; bare && i < nameLength; ++i) {
+        bare = isTokenChar(name[i]);
+    }
+    if(bare) {
+        emitText(w,name,nameLength);
+    } else {
+        emitString(w,name,nameLength);
+    }
+    emitChar(w,':');
+}
+
+ssize_t exportPayload(TextWriter* w, void* addr, uint8_t type, unsigned int depth) {
+    void* pos = addr;
+    uint8_t listType;
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+    float f;
+    double d;
+    ssize_t childPos;
+    int snbt = (w->format == TEXT_FORMAT_SNBT);
+
+    if(depth > TEXT_MAX_DEPTH) {
+        return TEXT_SYNTAX_ERROR;
+    }
+    switch(type) {
+        case TAG_BYTE:
+            emitInteger(w,*((int8_t*)pos));
+            if(snbt) {
+                emitChar(w,'b');
+            }
+            pos += sizeof(uint8_t);
+            break;
+        case TAG_SHORT:
+            u16 = __bswap_16(*((uint16_t*)pos));
+            emitInteger(w,(int16_t)u16);
+            if(snbt) {
+                emitChar(w,'s');
+            }
+            pos += sizeof(uint16_t);
+            break;
+        case TAG_INT:
+            u32 = __bswap_32(*((uint32_t*)pos));
+            emitInteger(w,(int32_t)u32);
+            pos += sizeof(uint32_t);
+            break;
+        case TAG_LONG:
+            u64 = __bswap_64(*((uint64_t*)pos));
+            emitInteger(w,(int64_t)u64);
+            if(snbt) {
+                emitChar(w,'L');
+            }
+            pos += sizeof(uint64_t);
+            break;
+        case TAG_FLOAT:
+            u32 = __bswap_32(*((uint32_t*)pos));
+            memcpy(&f,&u32,sizeof(float));
+            emitReal(w,f,1);
+            if(snbt) {
+                emitChar(w,'f');
+            }
+            pos += sizeof(uint32_t);
+            break;
+        case TAG_DOUBLE:
+            u64 = __bswap_64(*((uint64_t*)pos));
+            memcpy(&d,&u64,sizeof(double));
+            emitReal(w,d,0);
+            if(snbt) {
+                emitChar(w,'d');
+            }
+            pos += sizeof(uint64_t);
+            break;
+        case TAG_STRING:
+            u16 = __bswap_16(*((uint16_t*)pos));
+            pos += sizeof(uint16_t);
+            emitString(w,(const char*)pos,u16);
+            pos += u16;
+            break;
+        case TAG_BYTEARRAY:
+        case TAG_INTARRAY:
+            u32 = __bswap_32(*((uint32_t*)pos));
+            pos += sizeof(uint32_t);
+            emitChar(w,'[');
+            if(snbt) {
+                emitText(w,(type == TAG_BYTEARRAY) ? "B;" : "I;",2);
+            }
+            for(uint32_t i = 0; i < u32; ++i) {
+                if(i) {
+                    emitChar(w,',');
+                }
+                childPos = exportPayload(w,pos,(type == TAG_BYTEARRAY) ? TAG_BYTE : TAG_INT,depth + 1);
+                if(childPos < 0) {
+                    return childPos;
+                }
+                pos += childPos;
+            }
+            emitChar(w,']');
+            break;
+        case TAG_LIST:
+            listType = *((uint8_t*)pos);
+            u32 = __bswap_32(*((uint32_t*)(pos + sizeof(uint8_t))));
+            pos += sizeof(uint8_t) + sizeof(uint32_t);
+            emitChar(w,'[');
+            for(uint32_t i = 0; listType != TAG_END && i < u32; ++i) {
+                if(i) {
+                    emitChar(w,',');
+                }
+                childPos = exportPayload(w,pos,listType,depth + 1);
+                if(childPos < 0) {
+                    return childPos;
+                }
+                pos += childPos;
+            }
+            emitChar(w,']');
+            break;
+        case TAG_COMPOUND:
+            emitChar(w,'{');
+            for(int first = 1; *((uint8_t*)pos) != TAG_END; first = 0) {
+                uint8_t childType = *((uint8_t*)pos);
+                pos += sizeof(uint8_t);
+                u16 = __bswap_16(*((uint16_t*)pos));
+                pos += sizeof(uint16_t);
+                if(!first) {
+                    emitChar(w,',');
+                }
+                emitKey(w,(const char*)pos,u16);
+                pos += u16;
+                childPos = exportPayload(w,pos,childType,depth + 1);
+                if(childPos < 0) {
+                    return childPos;
+                }
+                pos += childPos;
+            }
+            pos += sizeof(uint8_t);
+            emitChar(w,'}');
+            break;
+        default:
+            return INVALID_TAG_TYPE;
+    }
+    return pos - addr;
+}
+
+ssize_t exportText(void* addr, int format, OutputSink* sink) {
+    // addr points at a whole tag, as with parseTag. The root tag's name has nowhere to go and is dropped
+    TextWriter* w = malloc(sizeof(TextWriter));
+    if(w == NULL) {
+        return MEMORY_ERROR;
+    }
+    w->sink = sink;
+    w->format = format;
+    w->err = SUCCESS;
+    w->used = 0;
+
+    void* pos = addr;
+    uint8_t type = *((uint8_t*)pos);
+    pos += sizeof(uint8_t);
+    pos += sizeof(uint16_t) + __bswap_16(*((uint16_t*)pos));
+    ssize_t payloadPos = exportPayload(w,pos,type,0);
+    flushText(w);
+    ssize_t err = w->err;
+    free(w);
+    if(payloadPos < 0) {
+        return payloadPos;
+    }
+    if(err < 0) {
+        return err;
+    }
+    pos += payloadPos;
+    return pos - addr;
+}
+
+int isTokenChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' || c == '+';
+}
+
+void skipWhitespace(TextReader* r) {
+    while(r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t' || *r->pos == '\n' || *r->pos == '\r')) {
+        ++r->pos;
+    }
+}
+
+int writeOut(TextReader* r, const void* data, size_t length) {
+    ssize_t nWritten = writeSink(&r->out.sink,data,length);
+    return (nWritten < 0) ? nWritten : SUCCESS;
+}
+
+int importString(TextReader* r) {
+    // Writes a TAG_STRING payload, which is also how tag names are laid out
+    char quote = *r->pos++;
+    size_t lengthPos = r->out.length;
+    uint16_t u16 = 0;
+    int err = writeOut(r,&u16,sizeof(uint16_t));
+    const char* runStart = r->pos;
+    while(err == SUCCESS) {
+        if(r->pos >= r->end) {
+            return TEXT_SYNTAX_ERROR;
+        }
+        char c = *r->pos;
+        if(c == quote) {
+            err = writeOut(r,runStart,r->pos - runStart);
+            ++r->pos;
+            break;
+        }
+        if(c != '\\') {
+            ++r->pos;
+            continue;
+        }
+
+        err = writeOut(r,runStart,r->pos - runStart);
+        if(err != SUCCESS || ++r->pos >= r->end) {
+            return (err != SUCCESS) ? err : TEXT_SYNTAX_ERROR;
+        }
+        char escaped = *r->pos++;
+        char utf8[4];
+        size_t utf8Length = 1;
+        switch(escaped) {
+            case 'n': utf8[0] = '\n'; break;
+            case 't': utf8[0] = '\t'; break;
+            case 'r': utf8[0] = '\r'; break;
+            case 'b': utf8[0] = '\b'; break;
+            case 'f': utf8[0] = '\f'; break;
+            case 'u': {
+                if(r->end - r->pos < 4) {
+                    return TEXT_SYNTAX_ERROR;
+                }
+                char hex[5] = {r->pos[0],r->pos[1],r->pos[2],r->pos[3],'\0'};
+                char* hexEnd;
+                unsigned long codePoint = strtoul(hex,&hexEnd,16);
+                if(hexEnd != hex + 4) {
+                    return TEXT_SYNTAX_ERROR;
+                }
+                r->pos += 4;
+                // Stored as Java's modified UTF-8, like the game does: NUL and surrogates get encoded on their own
+                if(codePoint != 0 && codePoint < 0x80) {
+                    utf8[0] = codePoint;
+                } else if(codePoint < 0x800) {
+                    utf8[0] = 0xC0 | (codePoint >> 6);
+                    utf8[1] = 0x80 | (codePoint & 0x3F);
+                    utf8Length = 2;
+                } else {
+                    utf8[0] = 0xE0 | (codePoint >> 12);
+                    utf8[1] = 0x80 | ((codePoint >> 6) & 0x3F);
+                    utf8[2] = 0x80 | (codePoint & 0x3F);
+                    utf8Length = 3;
+                }
+                break;
+            }
+            default:
+                // \\, \", \' and \/ stand for themselves
+                utf8[0] = escaped;
+                break;
+        }
+        err = writeOut(r,utf8,utf8Length);
+        runStart = r->pos;
+    }
+    if(err != SUCCESS) {
+        return err;
+    }
+
+    size_t length = r->out.length - lengthPos - sizeof(uint16_t);
+    if(length > UINT16_MAX) {
+        return TEXT_SYNTAX_ERROR;
+    }
+    u16 = __bswap_16((uint16_t)length);
+    memcpy((uint8_t*)r->out.data + lengthPos,&u16,sizeof(uint16_t));
+    return TAG_STRING;
+}
+
+int importToken(TextReader* r) {
+    // Numbers, booleans and, in SNBT, unquoted strings
+    const char* start = r->pos;
+    while(r->pos < r->end && isTokenChar(*r->pos)) {
+        ++r->pos;
+    }
+    size_t length = r->pos - start;
+    if(length == 0 || length > 64) {
+        if(length && r->format == TEXT_FORMAT_SNBT) {
+            goto bareString;
+        }
+        return TEXT_SYNTAX_ERROR;
+    }
+
+    char token[65];
+    memcpy(token,start,length);
+    token[length] = '\0';
+
+    if(!strcmp(token,"true") || !strcmp(token,"false")) {
+        uint8_t b = (token[0] == 't');
+        int err = writeOut(r,&b,sizeof(uint8_t));
+        return (err != SUCCESS) ? err : TAG_BYTE;
+    }
+    if(r->format == TEXT_FORMAT_JSON && !strcmp(token,"null")) {
+        // What export writes for nan and infinities, all of them come back as nan
+        uint64_t u64;
+        double d = NAN;
+        memcpy(&u64,&d,sizeof(double));
+        u64 = __bswap_64(u64);
+        int err = writeOut(r,&u64,sizeof(uint64_t));
+        return (err != SUCCESS) ? err : TAG_DOUBLE;
+    }
+
+    char suffix = '\0';
+    if(r->format == TEXT_FORMAT_SNBT && length > 1 && strchr("bBsSlLfFdD",token[length - 1])) {
+        suffix = token[length - 1] | 0x20;
+        token[length - 1] = '\0';
+    }
+    int real = (strpbrk(token,".eE") != NULL);
+    char* end;
+    int err = SUCCESS;
+    if(suffix == 'f' || suffix == 'd' || (suffix == '\0' && real)) {
+        double d = strtod(token,&end);
+        if(*end != '\0' || end == token) {
+            goto bareString;
+        }
+        if(suffix == 'f') {
+            float f = d;
+            uint32_t u32;
+            memcpy(&u32,&f,sizeof(float));
+            u32 = __bswap_32(u32);
+            err = writeOut(r,&u32,sizeof(uint32_t));
+            return (err != SUCCESS) ? err : TAG_FLOAT;
+        }
+        uint64_t u64;
+        memcpy(&u64,&d,sizeof(double));
+        u64 = __bswap_64(u64);
+        err = writeOut(r,&u64,sizeof(uint64_t));
+        return (err != SUCCESS) ? err : TAG_DOUBLE;
+    }
+
+    errno = 0;
+    long long value = strtoll(token,&end,10);
+    if(*end != '\0' || end == token || errno == ERANGE) {
+        goto bareString;
+    }
+    if(suffix == 'b' && value >= INT8_MIN && value <= INT8_MAX) {
+        int8_t b = value;
+        err = writeOut(r,&b,sizeof(int8_t));
+        return (err != SUCCESS) ? err : TAG_BYTE;
+    }
+    if(suffix == 's' && value >= INT16_MIN && value <= INT16_MAX) {
+        uint16_t u16 = __bswap_16((uint16_t)value);
+        err = writeOut(r,&u16,sizeof(uint16_t));
+        return (err != SUCCESS) ? err : TAG_SHORT;
+    }
+    if(suffix == '\0' && value >= INT32_MIN && value <= INT32_MAX) {
+        uint32_t u32 = __bswap_32((uint32_t)value);
+        err = writeOut(r,&u32,sizeof(uint32_t));
+        return (err != SUCCESS) ? err : TAG_INT;
+    }
+    if(suffix == 'l' || suffix == '\0') {
+        // Integers too big for an int still fit a long
+        uint64_t u64 = __bswap_64((uint64_t)value);
+        err = writeOut(r,&u64,sizeof(uint64_t));
+        return (err != SUCCESS) ? err : TAG_LONG;
+    }
+
+bareString:
+    if(r->format != TEXT_FORMAT_SNBT || length > UINT16_MAX) {
+        return TEXT_SYNTAX_ERROR;
+    }
+    uint16_t u16 = __bswap_16((uint16_t)length);
+    err = writeOut(r,&u16,sizeof(uint16_t));
+    if(err == SUCCESS) {
+        err = writeOut(r,start,length);
+    }
+    return (err != SUCCESS) ? err : TAG_STRING;
+}
+
+int importArray(TextReader* r, uint8_t arrayType) {
+    // SNBT [B;...] and [I;...], the opening bracket and prefix are already consumed
+    uint8_t elementType = (arrayType == TAG_BYTEARRAY) ? TAG_BYTE : TAG_INT;
+    size_t countPos = r->out.length;
+    uint32_t count = 0;
+    int err = writeOut(r,&count,sizeof(uint32_t));
+    skipWhitespace(r);
+    while(err == SUCCESS && r->pos < r->end && *r->pos != ']') {
+        if(count) {
+            if(*r->pos != ',') {
+                return TEXT_SYNTAX_ERROR;
+            }
+            ++r->pos;
+            skipWhitespace(r);
+        }
+        // Byte arrays may leave out the b suffix on their elements
+        size_t elementPos = r->out.length;
+        int type = importToken(r);
+        if(type < 0) {
+            return type;
+        }
+        if(type == TAG_INT && elementType == TAG_BYTE) {
+            int32_t value = (int32_t)__bswap_32(*(uint32_t*)((uint8_t*)r->out.data + elementPos));
+            if(value < INT8_MIN || value > INT8_MAX) {
+                return TEXT_SYNTAX_ERROR;
+            }
+            ((int8_t*)r->out.data)[elementPos] = value;
+            r->out.length = elementPos + sizeof(int8_t);
+        } else if(type != elementType) {
+            return TEXT_SYNTAX_ERROR;
+        }
+        ++count;
+        skipWhitespace(r);
+    }
+    if(err != SUCCESS) {
+        return err;
+    }
+    if(r->pos >= r->end) {
+        return TEXT_SYNTAX_ERROR;
+    }
+    ++r->pos;
+    count = __bswap_32(count);
+    memcpy((uint8_t*)r->out.data + countPos,&count,sizeof(uint32_t));
+    return arrayType;
+}
+
+int numberRank(uint8_t type) {
+    // What JSON numbers import as, narrowest first
+    switch(type) {
+        case TAG_INT:
+            return 1;
+        case TAG_LONG:
+            return 2;
+        case TAG_DOUBLE:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+int widenNumbers(TextReader* r, size_t start, uint32_t count, uint8_t from, uint8_t to) {
+    // The count elements at start must be the last thing written. Converted back to front,
+    // since each one only ever grows into space the ones after it have vacated
+    size_t fromSize = getTypeSize(from);
+    size_t toSize = getTypeSize(to);
+    uint8_t zero[sizeof(uint64_t)] = {0};
+    for(uint32_t i = 0; i < count && toSize > fromSize; ++i) {
+        int err = writeOut(r,zero,toSize - fromSize);
+        if(err != SUCCESS) {
+            return err;
+        }
+    }
+    uint8_t* data = (uint8_t*)r->out.data + start;
+    for(uint32_t i = count; i-- > 0;) {
+        int64_t value = 0;
+        double d;
+        uint32_t u32;
+        uint64_t u64;
+        if(from == TAG_INT) {
+            memcpy(&u32,data + i * fromSize,sizeof(uint32_t));
+            value = (int32_t)__bswap_32(u32);
+        } else {
+            memcpy(&u64,data + i * fromSize,sizeof(uint64_t));
+            value = (int64_t)__bswap_64(u64);
+        }
+        if(to == TAG_LONG) {
+            u64 = __bswap_64((uint64_t)value);
+        } else {
+            d = value;
+            memcpy(&u64,&d,sizeof(double));
+            u64 = __bswap_64(u64);
+        }
+        memcpy(data + i * toSize,&u64,sizeof(uint64_t));
+    }
+    return SUCCESS;
+}
+
+int importList(TextReader* r) {
+    ++r->pos;
+    skipWhitespace(r);
+    if(r->format == TEXT_FORMAT_SNBT && r->end - r->pos >= 2 && r->pos[1] == ';') {
+        char prefix = r->pos[0];
+        r->pos += 2;
+        if(prefix == 'B') {
+            return importArray(r,TAG_BYTEARRAY);
+        } else if(prefix == 'I') {
+            return importArray(r,TAG_INTARRAY);
+        }
+        // No long arrays in this library
+        return INVALID_TAG_TYPE;
+    }
+
+    size_t headerPos = r->out.length;
+    uint8_t listHeader[sizeof(uint8_t) + sizeof(uint32_t)] = {0};
+    int err = writeOut(r,listHeader,sizeof(listHeader));
+    uint8_t listType = TAG_END;
+    uint32_t count = 0;
+    while(err == SUCCESS && r->pos < r->end && *r->pos != ']') {
+        if(count) {
+            if(*r->pos != ',') {
+                return TEXT_SYNTAX_ERROR;
+            }
+            ++r->pos;
+            skipWhitespace(r);
+        }
+        size_t elementPos = r->out.length;
+        int type = importValue(r);
+        if(type < 0) {
+            return type;
+        }
+        if(count && type != listType && r->format == TEXT_FORMAT_JSON && numberRank(type) && numberRank(listType)) {
+            // JSON doesn't say which numbers are longs or doubles, so mixed lists take the widest type seen
+            size_t elementsPos = headerPos + sizeof(listHeader);
+            if(numberRank(type) > numberRank(listType)) {
+                uint64_t element;
+                memcpy(&element,(uint8_t*)r->out.data + elementPos,sizeof(uint64_t));
+                r->out.length = elementPos;
+                err = widenNumbers(r,elementsPos,count,listType,type);
+                if(err == SUCCESS) {
+                    err = writeOut(r,&element,sizeof(uint64_t));
+                }
+                listType = type;
+            } else {
+                err = widenNumbers(r,elementPos,1,type,listType);
+            }
+            if(err != SUCCESS) {
+                return err;
+            }
+            type = listType;
+        }
+        if(count && type != listType) {
+            // Lists are homogeneous in NBT
+            return INVALID_TAG_TYPE;
+        }
+        listType = type;
+        ++count;
+        skipWhitespace(r);
+    }
+    if(err != SUCCESS) {
+        return err;
+    }
+    if(r->pos >= r->end) {
+        return TEXT_SYNTAX_ERROR;
+    }
+    ++r->pos;
+    listHeader[0] = listType;
+    count = __bswap_32(count);
+    memcpy(listHeader + sizeof(uint8_t),&count,sizeof(uint32_t));
+    memcpy((uint8_t*)r->out.data + headerPos,listHeader,sizeof(listHeader));
+    return TAG_LIST;
+}
+
+int importCompound(TextReader* r) {
+    ++r->pos;
+    skipWhitespace(r);
+    int err = SUCCESS;
+    for(int first = 1; r->pos < r->end && *r->pos != '}'; first = 0) {
+        if(!first) {
+            if(*r->pos != ',') {
+                return TEXT_SYNTAX_ERROR;
+            }
+            ++r->pos;
+            skipWhitespace(r);
+            if(r->pos >= r->end) {
+                return TEXT_SYNTAX_ERROR;
+            }
+        }
+
+        // Type isn't known until the value is parsed, leave room for it
+        size_t typePos = r->out.length;
+        uint8_t type = TAG_END;
+        err = writeOut(r,&type,sizeof(uint8_t));
+        if(err != SUCCESS) {
+            return err;
+        }
+        if(*r->pos == '"' || (r->format == TEXT_FORMAT_SNBT && *r->pos == '\'')) {
+            err = importString(r);
+        } else if(r->format == TEXT_FORMAT_SNBT) {
+            const char* start = r->pos;
+            while(r->pos < r->end && isTokenChar(*r->pos)) {
+                ++r->pos;
+            }
+            uint16_t u16 = __bswap_16((uint16_t)(r->pos - start));
+            err = (r->pos == start || r->pos - start > UINT16_MAX) ? TEXT_SYNTAX_ERROR : writeOut(r,&u16,sizeof(uint16_t));
+            if(err == SUCCESS) {
+                err = writeOut(r,start,r->pos - start);
+            }
+        } else {
+            err = TEXT_SYNTAX_ERROR;
+        }
+        if(err < 0) {
+            return err;
+        }
+
+        skipWhitespace(r);
+        if(r->pos >= r->end || *r->pos != ':') {
+            return TEXT_SYNTAX_ERROR;
+        }
+        ++r->pos;
+        skipWhitespace(r);
+        int valueType = importValue(r);
+        if(valueType < 0) {
+            return valueType;
+        }
+        ((uint8_t*)r->out.data)[typePos] = valueType;
+        skipWhitespace(r);
+    }
+    if(r->pos >= r->end) {
+        return TEXT_SYNTAX_ERROR;
+    }
+    ++r->pos;
+    uint8_t end = TAG_END;
+    err = writeOut(r,&end,sizeof(uint8_t));
+    return (err != SUCCESS) ? err : TAG_COMPOUND;
+}
+
+int importValue(TextReader* r) {
+    // Writes the payload for whatever comes next and returns its tag type
+    skipWhitespace(r);
+    if(r->pos >= r->end || r->depth > TEXT_MAX_DEPTH) {
+        return TEXT_SYNTAX_ERROR;
+    }
+    int type;
+    ++r->depth;
+    switch(*r->pos) {
+        case '{':
+            type = importCompound(r);
+            break;
+        case '[':
+            type = importList(r);
+            break;
+        case '"':
+            type = importString(r);
+            break;
+        case '\'':
+            type = (r->format == TEXT_FORMAT_SNBT) ? importString(r) : TEXT_SYNTAX_ERROR;
+            break;
+        default:
+            type = importToken(r);
+            break;
+    }
+    --r->depth;
+    return type;
+}
+
+ssize_t importText(const char* text, size_t textLength, int format, void** data) {
+    // Produces a root compound with an empty name, ready for parseTag or writing out as is
+    TextReader r;
+    r.pos = text;
+    r.end = text + textLength;
+    r.format = format;
+    r.depth = 0;
+    initBufferSink(&r.out);
+
+    skipWhitespace(&r);
+    if(r.pos >= r.end || *r.pos != '{') {
+        return TEXT_SYNTAX_ERROR;
+    }
+    uint8_t rootHeader[sizeof(uint8_t) + sizeof(uint16_t)] = {TAG_COMPOUND,0,0};
+    int err = writeOut(&r,rootHeader,sizeof(rootHeader));
+    if(err == SUCCESS) {
+        err = importValue(&r);
+    }
+    if(err >= 0) {
+        skipWhitespace(&r);
+        err = (r.pos == r.end) ? SUCCESS : TEXT_SYNTAX_ERROR;
+    }
+    if(err != SUCCESS) {
+        free(r.out.data);
+        return err;
+    }
+    *data = r.out.data;
+    return r.out.length;
+}
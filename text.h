@@ -0,0 +1,52 @@
+#ifndef _TEXT_H
+#define _TEXT_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <byteswap.h>
+
+#include "nbt.h"
+#include "sink.h"
+#include "errors.h"
+
+#ifndef TEXT_MAX_DEPTH
+#define TEXT_MAX_DEPTH 512
+#endif
+
+// JSON carries less type information than NBT. On export bytes, shorts and
+// longs become plain numbers. On import whole numbers become TAG_INT (TAG_LONG
+// when they don't fit), anything else TAG_DOUBLE, and true/false TAG_BYTE.
+// JSON has no nan or infinity, those are exported as null, which imports as a
+// nan TAG_DOUBLE. Arrays must hold a single type, as NBT lists do, except
+// that numbers are widened to the widest one in the array: whole numbers to
+// TAG_LONG if any needs it, and everything to TAG_DOUBLE if any is fractional
+enum TEXT_FORMAT {
+    TEXT_FORMAT_SNBT = 0,
+    TEXT_FORMAT_JSON
+};
+
+// Output is staged here and handed to the sink SINK_BUFFER_SIZE bytes at a time
+typedef struct TextWriter {
+    OutputSink* sink;
+    int format;
+    ssize_t err;
+    size_t used;
+    char buffer[SINK_BUFFER_SIZE];
+} TextWriter;
+
+typedef struct TextReader {
+    const char* pos;
+    const char* end;
+    int format;
+    unsigned int depth;
+    BufferSink out;
+} TextReader;
+
+ssize_t exportText(void* addr, int format, OutputSink* sink);
+ssize_t importText(const char* text, size_t textLength, int format, void** data);
+
+#endif